@@ -69,4 +69,19 @@ aabb surrounding_box(aabb box0, aabb box1) {
 		fmax(box0.max().z(), box1.max().z())
 	);
 	return aabb(small, big);
+}
+
+// flat boxes are missed by aabb::hit once the slab is thinner than the float
+// spacing of t, so pad them relative to the size of the box
+inline aabb padded_box(const vec3& lo, const vec3& hi) {
+	vec3 plo = lo, phi = hi;
+	vec3 d = hi - lo;
+	float pad = ffmax(1e-5f, 1e-4f * ffmax(d.x(), ffmax(d.y(), d.z())));
+	for (int a = 0; a < 3; a++) {
+		if (d[a] < pad) {
+			plo[a] -= pad;
+			phi[a] += pad;
+		}
+	}
+	return aabb(plo, phi);
 }
\ No newline at end of file
@@ -0,0 +1,143 @@
+#pragma once
+#include "hittable.h"
+
+// affine transform, the top three rows of a 4x4 matrix
+class affine {
+public:
+	affine();
+	static affine translation(const vec3& offset);
+	static affine scaling(const vec3& factor);
+	static affine rotation(const vec3& axis, float angle);
+	vec3 point(const vec3& p) const;
+	vec3 vector(const vec3& v) const;
+	vec3 transposed_vector(const vec3& v) const;
+	affine inverse() const;
+	aabb box(const aabb& b) const;
+
+	float m[3][4];
+};
+
+affine::affine() {
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 4; j++)
+			m[i][j] = i == j ? 1.0f : 0.0f;
+	}
+}
+
+affine affine::translation(const vec3& offset) {
+	affine a;
+	a.m[0][3] = offset.x();
+	a.m[1][3] = offset.y();
+	a.m[2][3] = offset.z();
+	return a;
+}
+
+affine affine::scaling(const vec3& factor) {
+	affine a;
+	a.m[0][0] = factor.x();
+	a.m[1][1] = factor.y();
+	a.m[2][2] = factor.z();
+	return a;
+}
+
+// angle in degrees around axis, like rotate_y
+affine affine::rotation(const vec3& axis, float angle) {
+	vec3 n = unit_vector(axis);
+	float radians = (M_PI / 180) * angle;
+	float s = sin(radians);
+	float c = cos(radians);
+	float t = 1 - c;
+	affine a;
+	a.m[0][0] = t * n.x() * n.x() + c;
+	a.m[0][1] = t * n.x() * n.y() - s * n.z();
+	a.m[0][2] = t * n.x() * n.z() + s * n.y();
+	a.m[1][0] = t * n.x() * n.y() + s * n.z();
+	a.m[1][1] = t * n.y() * n.y() + c;
+	a.m[1][2] = t * n.y() * n.z() - s * n.x();
+	a.m[2][0] = t * n.x() * n.z() - s * n.y();
+	a.m[2][1] = t * n.y() * n.z() + s * n.x();
+	a.m[2][2] = t * n.z() * n.z() + c;
+	return a;
+}
+
+inline vec3 affine::point(const vec3& p) const {
+	return vec3(
+		m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+		m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+		m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]
+	);
+}
+
+inline vec3 affine::vector(const vec3& v) const {
+	return vec3(
+		m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+		m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+		m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z()
+	);
+}
+
+// applied to the inverse this transforms normals to the other space
+inline vec3 affine::transposed_vector(const vec3& v) const {
+	return vec3(
+		m[0][0] * v.x() + m[1][0] * v.y() + m[2][0] * v.z(),
+		m[0][1] * v.x() + m[1][1] * v.y() + m[2][1] * v.z(),
+		m[0][2] * v.x() + m[1][2] * v.y() + m[2][2] * v.z()
+	);
+}
+
+affine affine::inverse() const {
+	float a00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+	float a01 = m[0][2] * m[2][1] - m[0][1] * m[2][2];
+	float a02 = m[0][1] * m[1][2] - m[0][2] * m[1][1];
+	float a10 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+	float a11 = m[0][0] * m[2][2] - m[0][2] * m[2][0];
+	float a12 = m[0][2] * m[1][0] - m[0][0] * m[1][2];
+	float a20 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+	float a21 = m[0][1] * m[2][0] - m[0][0] * m[2][1];
+	float a22 = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+	float det = m[0][0] * a00 + m[0][1] * a10 + m[0][2] * a20;
+	float k = 1.0f / det;
+	affine r;
+	r.m[0][0] = a00 * k; r.m[0][1] = a01 * k; r.m[0][2] = a02 * k;
+	r.m[1][0] = a10 * k; r.m[1][1] = a11 * k; r.m[1][2] = a12 * k;
+	r.m[2][0] = a20 * k; r.m[2][1] = a21 * k; r.m[2][2] = a22 * k;
+	vec3 t = r.vector(vec3(m[0][3], m[1][3], m[2][3]));
+	r.m[0][3] = -t.x();
+	r.m[1][3] = -t.y();
+	r.m[2][3] = -t.z();
+	return r;
+}
+
+aabb affine::box(const aabb& b) const {
+	vec3 min( FLT_MAX,  FLT_MAX,  FLT_MAX);
+	vec3 max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (int i = 0; i < 2; i++) {
+		for (int j = 0; j < 2; j++) {
+			for (int k = 0; k < 2; k++) {
+				vec3 corner = point(vec3(
+					i ? b.max().x() : b.min().x(),
+					j ? b.max().y() : b.min().y(),
+					k ? b.max().z() : b.min().z()
+				));
+				for (int c = 0; c < 3; c++) {
+					min[c] = ffmin(min[c], corner[c]);
+					max[c] = ffmax(max[c], corner[c]);
+				}
+			}
+		}
+	}
+	return aabb(min, max);
+}
+
+// a * b applies b first
+affine operator*(const affine& a, const affine& b) {
+	affine r;
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 4; j++) {
+			r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j];
+			if (j == 3)
+				r.m[i][j] += a.m[i][3];
+		}
+	}
+	return r;
+}
\ No newline at end of file
@@ -0,0 +1,76 @@
+#pragma once
+#include <vector>
+
+// discrete distribution proportional to a list of weights, sampled in
+// constant time with Vose's alias method. each bin keeps its own index with
+// probability threshold and otherwise redirects to its alias.
+class alias_table {
+public:
+	alias_table() : sum(0) {}
+	alias_table(const float* weights, int n);
+	int sample(float u, float& pdf) const;	// u in [0, 1)
+	float pdf(int i) const { return bins[i].pdf; }
+	float total() const { return sum; }
+	int size() const { return int(bins.size()); }
+
+private:
+	struct bin {
+		float threshold;
+		int alias;
+		float pdf;
+	};
+
+	std::vector<bin> bins;
+	float sum;
+};
+
+// alias table
+// -----------
+alias_table::alias_table(const float* weights, int n) : bins(n) {
+	double total = 0;
+	for (int i = 0; i < n; i++)
+		total += weights[i];
+	sum = float(total);
+	std::vector<double> scaled(n);
+	std::vector<int> small, large;
+	for (int i = 0; i < n; i++) {
+		// all zero weights fall back to uniform
+		bins[i].pdf = total > 0 ? float(weights[i] / total) : 1.0f / n;
+		scaled[i] = total > 0 ? weights[i] * n / total : 1.0;
+		bins[i].alias = i;
+		if (scaled[i] < 1.0)
+			small.push_back(i);
+		else
+			large.push_back(i);
+	}
+	while (!small.empty() && !large.empty()) {
+		int s = small.back();
+		small.pop_back();
+		int l = large.back();
+		bins[s].threshold = float(scaled[s]);
+		bins[s].alias = l;
+		scaled[l] -= 1.0 - scaled[s];
+		if (scaled[l] < 1.0) {
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+	// whatever is left is 1 up to rounding
+	for (size_t i = 0; i < small.size(); i++)
+		bins[small[i]].threshold = 1.0f;
+	for (size_t i = 0; i < large.size(); i++)
+		bins[large[i]].threshold = 1.0f;
+}
+
+// the fraction left after picking the bin decides between it and its alias
+inline int alias_table::sample(float u, float& pdf) const {
+	int n = int(bins.size());
+	float x = u * n;
+	int i = int(x);
+	if (i > n - 1)
+		i = n - 1;
+	if (x - i >= bins[i].threshold)
+		i = bins[i].alias;
+	pdf = bins[i].pdf;
+	return i;
+}
\ No newline at end of file
@@ -0,0 +1,81 @@
+#pragma once
+#include <math.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "heatmap.h"
+#include "stb_image_write.h"
+#include "vec3.h"
+
+// first hit AOVs: the albedo, shading normal and distance where each camera
+// ray first lands, summed over the samples like the radiance. the squares go
+// along so the denoiser can tell how much a feature varies inside a pixel, at
+// silhouettes, under glass or behind depth of field.
+struct aov_sample {
+	aov_sample() : albedo(0, 0, 0), normal(0, 0, 0), depth(0) {}
+
+	vec3 albedo;	// reflectance of the surface, emission clamped to 1 on lights
+	vec3 normal;	// zero where the ray escapes
+	float depth;	// distance to the hit, zero where the ray escapes
+};
+
+class aov_buffer {
+public:
+	enum channel { albedo_r, albedo_g, albedo_b, normal_x, normal_y, normal_z, depth, channel_count };
+
+	aov_buffer(int width, int height) : nx(width), ny(height), samples(0) {
+		for (int c = 0; c < channel_count; c++) {
+			sums[c].assign(width * height, 0.0f);
+			squares[c].assign(width * height, 0.0f);
+		}
+	}
+	void add(int x, int y, const aov_sample& s);
+	void finish_pass(int n) { samples += n; }
+	int sample_count() const { return samples; }
+	float mean(int c, int i) const { return samples > 0 ? sums[c][i] / samples : 0.0f; }
+	float variance(int c, int i) const;
+	bool write(const std::string& base) const;
+
+	const int nx, ny;
+
+private:
+	std::vector<float> sums[channel_count];
+	std::vector<float> squares[channel_count];
+	int samples;
+};
+
+// aov buffer
+// ----------
+void aov_buffer::add(int x, int y, const aov_sample& s) {
+	float values[channel_count] = { s.albedo[0], s.albedo[1], s.albedo[2], s.normal[0], s.normal[1], s.normal[2], s.depth };
+	int i = y * nx + x;
+	for (int c = 0; c < channel_count; c++) {
+		sums[c][i] += values[c];
+		squares[c][i] += values[c] * values[c];
+	}
+}
+
+// unbiased sample variance of one sample, like framebuffer::variance
+float aov_buffer::variance(int c, int i) const {
+	if (samples < 2)
+		return 0.0f;
+	float m = mean(c, i);
+	return std::max(0.0f, (squares[c][i] - samples * m * m) / (samples - 1));
+}
+
+// base.albedo.png gamma 2 like the image, base.normal.png mapped from [-1, 1]
+// and the raw distances as base.depth.pfm
+bool aov_buffer::write(const std::string& base) const {
+	std::vector<unsigned char> albedo(3 * nx * ny), normal(3 * nx * ny);
+	std::vector<float> distance(nx * ny);
+	for (int i = 0; i < nx * ny; i++) {
+		for (int k = 0; k < 3; k++) {
+			albedo[3 * i + k] = (unsigned char)std::min(255.0f, 255.99f * sqrt(std::max(0.0f, mean(albedo_r + k, i))));
+			normal[3 * i + k] = (unsigned char)std::min(255.0f, std::max(0.0f, 127.99f * (mean(normal_x + k, i) + 1)));
+		}
+		distance[i] = mean(depth, i);
+	}
+	return stbi_write_png((base + ".albedo.png").c_str(), nx, ny, 3, albedo.data(), 3 * nx) != 0
+		&& stbi_write_png((base + ".normal.png").c_str(), nx, ny, 3, normal.data(), 3 * nx) != 0
+		&& write_pfm(base + ".depth.pfm", distance, nx, ny);
+}
\ No newline at end of file
@@ -0,0 +1,133 @@
+#pragma once
+#include <stddef.h>
+#include <stdlib.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// monotonic allocator for everything that lives as long as a scene: objects
+// are bumped into large blocks one after another and never freed singly.
+// destroying the arena runs the destructors that matter in reverse order of
+// construction and frees every block at once. allocation is not thread safe,
+// threads building in parallel take an arena each.
+class arena {
+public:
+	arena(size_t block_size = 1 << 20) : block_size(block_size), used(0), reserved(0) {}
+	arena(const arena&) = delete;
+	arena& operator=(const arena&) = delete;
+	~arena();
+	void* allocate(size_t size, size_t alignment);
+	template <class T, class... Args> T* make(Args&&... args);
+	template <class T> T* make_array(size_t n);
+	template <class T> T* allocate_array(size_t n);
+	template <class T> void own_array(T* objects, size_t n);
+	template <class T> T* adopt(T* object);
+	size_t bytes_used() const { return used; }
+	size_t bytes_reserved() const { return reserved; }
+
+private:
+	struct block {
+		char* data;
+		size_t size, top;
+	};
+	struct release {
+		void (*destroy)(void* objects, size_t n);
+		void* objects;
+		size_t n;
+	};
+	template <class T> static void destroy(void* objects, size_t n);
+	template <class T> static void destroy_heap(void* object, size_t n);
+
+	size_t block_size;
+	size_t used, reserved;
+	std::vector<block> blocks;
+	std::vector<release> releases;
+};
+
+// arena
+// -----
+arena::~arena() {
+	for (size_t i = releases.size(); i-- > 0;)
+		releases[i].destroy(releases[i].objects, releases[i].n);
+	for (size_t i = 0; i < blocks.size(); i++)
+		free(blocks[i].data);
+}
+
+// requests larger than a quarter block get a block of their own, so big
+// arrays do not waste the rest of the current one
+void* arena::allocate(size_t size, size_t alignment) {
+	if (!blocks.empty()) {
+		block& b = blocks.back();
+		size_t start = (b.top + alignment - 1) & ~(alignment - 1);
+		if (start + size <= b.size) {
+			b.top = start + size;
+			used += size;
+			return b.data + start;
+		}
+	}
+	size_t capacity = size + alignment > block_size / 4 ? size + alignment : block_size;
+	block b;
+	b.data = static_cast<char*>(malloc(capacity));
+	if (!b.data)
+		throw std::bad_alloc();
+	b.size = capacity;
+	size_t start = (size_t(-reinterpret_cast<ptrdiff_t>(b.data))) & (alignment - 1);
+	b.top = start + size;
+	reserved += capacity;
+	used += size;
+	// a dedicated block goes below the current one, which keeps filling
+	if (capacity != block_size && !blocks.empty())
+		blocks.insert(blocks.end() - 1, b);
+	else
+		blocks.push_back(b);
+	return b.data + start;
+}
+
+template <class T> void arena::destroy(void* objects, size_t n) {
+	T* p = static_cast<T*>(objects);
+	for (size_t i = n; i-- > 0;)
+		p[i].~T();
+}
+
+template <class T> void arena::destroy_heap(void* object, size_t n) {
+	delete static_cast<T*>(object);
+}
+
+template <class T, class... Args> T* arena::make(Args&&... args) {
+	T* object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+	if (!std::is_trivially_destructible<T>::value)
+		own_array(object, 1);
+	return object;
+}
+
+// n default constructed objects
+template <class T> T* arena::make_array(size_t n) {
+	T* objects = allocate_array<T>(n);
+	for (size_t i = 0; i < n; i++)
+		new (objects + i) T();
+	own_array(objects, n);
+	return objects;
+}
+
+// raw room for n objects, constructed by the caller and then handed to own_array
+template <class T> T* arena::allocate_array(size_t n) {
+	return static_cast<T*>(allocate(n * sizeof(T), alignof(T)));
+}
+
+// destroys n constructed objects when the arena goes
+template <class T> void arena::own_array(T* objects, size_t n) {
+	if (std::is_trivially_destructible<T>::value || n == 0)
+		return;
+	release r = { &arena::destroy<T>, objects, n };
+	releases.push_back(r);
+}
+
+// takes over something from new, deleted with the arena
+template <class T> T* arena::adopt(T* object) {
+	if (object) {
+		release r = { &arena::destroy_heap<T>, object, 1 };
+		releases.push_back(r);
+	}
+	return object;
+}
\ No newline at end of file
@@ -0,0 +1,936 @@
+#include "rect.h"
+#include "box.h"
+#include "camera.h"
+#include "denoise.h"
+#include "framebuffer.h"
+#include "hittable_bvh.h"
+#include "material.h"
+#include "model.h"
+#include "random.h"
+#include "render.h"
+#include "sbvh.h"
+#include "scene.h"
+#include "settings.h"
+#include "sphere.h"
+#include "stats.h"
+#include "texture_cache.h"
+#include "trace.h"
+#include "transform.h"
+#include "triangle.h"
+#include "vec3_simd.h"
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include <float.h>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+using namespace std;
+
+// fixed scenes timed the same way on every run, written as json so runs on
+// different commits can be compared. for every scene it reports the bvh build
+// time, single thread closest hit rates for primary, secondary and shadow
+// rays cast in batches (no shading), the end to end sample rate of the full
+// renderer on all threads and the peak memory of the process so far. mesh
+// scenes also cast the ray batches through their tree in the binary layout,
+// before compressing it as the renderer does, report the node memory of both
+// and the sah cost against a tree without spatial splits. scenes run smallest
+// first so the peak memory grows with them.
+//
+// before any scene a few checks run, and the run fails if one is off: the
+// round trip errors of the compact mesh normals and uvs and of fast_rsqrt, a
+// nested chain of transforms against the single node it flattens to, the
+// shadow rays of the cornell box, which must run up to the light, and the
+// tiled texture cache against the image texture under a budget small enough
+// to evict. --checks stops after them.
+//
+// after the scenes the denoiser is rated on the cornell box: its error at a
+// few sample counts against a long render, and the samples the unfiltered
+// render needs for the same error. run from the directory holding
+// resources/, like the renderer.
+
+struct benchmark_options {
+	benchmark_options() : output_path("benchmark.json"), resources("resources/"), nx(256), ny(256), ns(4),
+		threads(max(1, int(std::thread::hardware_concurrency()))), min_seconds(0.5), denoise_reference_spp(1024), checks_only(false) {}
+
+	string output_path;
+	string resources;
+	string label;	// free text copied to the json, e.g. a commit hash
+	string only;	// run only scenes whose name contains this
+	string baseline_path;	// earlier results to print speedups against
+	int nx, ny, ns;
+	int threads;
+	double min_seconds;	// each ray batch repeats until this much time has passed
+	int denoise_reference_spp;	// samples of the denoising reference, 0 to skip it
+	bool checks_only;	// stop after the accuracy checks, without results
+};
+
+struct benchmark_scene {
+	benchmark_scene() : primitives(-1), build_seconds(0), mesh(0), references(0), sah_cost(0), object_sah_cost(0) {}
+
+	string name;
+	scene description;
+	long primitives;	// -1 when the scene file does not tell
+	double build_seconds;
+	sbvh* mesh;	// binary until run_benchmark compresses it, 0 for other scenes
+	long references;	// leaf references of the mesh tree, more than primitives with spatial splits
+	double sah_cost, object_sah_cost;	// of the mesh tree, and of one with object splits only
+};
+
+struct ray_rate {
+	double per_second;
+	double hit_fraction;
+	double nodes_per_ray;	// 0 without RENDER_STATS
+};
+
+struct benchmark_result {
+	string name;
+	long primitives;
+	double build_seconds;
+	ray_rate primary, secondary, shadow;
+	ray_rate binary_primary, binary_secondary, binary_shadow;	// mesh scenes before compressing
+	size_t node_bytes, binary_node_bytes;	// of the mesh tree, 0 for other scenes
+	long references;
+	double sah_cost, object_sah_cost;
+	double samples_per_second;
+	double render_rays_per_second;	// camera, secondary and shadow rays of the integrator
+	size_t peak_memory;
+};
+
+struct denoise_level {
+	int spp;
+	double raw_error, denoised_error;	// relative mean squared error against the reference
+	double equal_error_spp;	// samples the unfiltered render needs for the denoised error
+	double seconds;	// of the denoiser
+};
+
+struct denoise_study {
+	int nx, ny;
+	int reference_spp;
+	vector<denoise_level> levels;
+};
+
+inline double benchmark_seconds(chrono::steady_clock::time_point start) {
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// scenes
+// ------
+bool cornell_benchmark(const benchmark_options& options, benchmark_scene& b) {
+	b.name = "cornell";
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	if (!load_scene(options.resources + "cornell.scene", b.description))
+		return false;
+	// includes parsing and mapping the cached mesh trees, as a render would
+	b.build_seconds = benchmark_seconds(start);
+	return true;
+}
+
+// the triangles sit side by side in memory, as import_model keeps them
+bool obj_triangles(const string& path, material* mat, vector<Triangle*>& triangles, arena& memory) {
+	Model model(path);
+	size_t count = 0;
+	for (unsigned int i = 0; i < model.meshes.size(); i++)
+		count += model.meshes[i].indices.size() / 3;
+	Triangle* storage = memory.allocate_array<Triangle>(count);
+	for (unsigned int i = 0; i < model.meshes.size(); i++) {
+		const Mesh& mesh = model.meshes[i];
+		for (unsigned int j = 0; j + 2 < mesh.indices.size(); j += 3)
+			triangles.push_back(new (storage + triangles.size()) Triangle(mesh.vertices[mesh.indices[j]], mesh.vertices[mesh.indices[j + 1]], mesh.vertices[mesh.indices[j + 2]], mat));
+	}
+	memory.own_array(storage, triangles.size());
+	return !triangles.empty();
+}
+
+// a rippled torus of 2 * rings * segments triangles, no poles so no slivers
+void torus_triangles(int rings, int segments, material* mat, vector<Triangle*>& triangles, arena& memory) {
+	const float R = 1.0f, r = 0.3f;
+	vector<Vertex> grid((rings + 1) * (segments + 1));
+	for (int i = 0; i <= rings; i++) {
+		for (int j = 0; j <= segments; j++) {
+			float phi = 2 * float(M_PI) * i / rings;
+			float theta = 2 * float(M_PI) * j / segments;
+			float ripple = r * (1 + 0.08f * sin(24 * phi) * sin(12 * theta));
+			vec3 normal(cos(phi) * cos(theta), sin(theta), sin(phi) * cos(theta));
+			Vertex& v = grid[i * (segments + 1) + j];
+			v.position = vec3(R * cos(phi), 0, R * sin(phi)) + ripple * normal;
+			v.normal = normal;
+			v.u = float(i) / rings;
+			v.v = float(j) / segments;
+		}
+	}
+	Triangle* storage = memory.allocate_array<Triangle>(2 * size_t(rings) * segments);
+	triangles.reserve(2 * size_t(rings) * segments);
+	for (int i = 0; i < rings; i++) {
+		for (int j = 0; j < segments; j++) {
+			const Vertex& a = grid[i * (segments + 1) + j];
+			const Vertex& b = grid[(i + 1) * (segments + 1) + j];
+			const Vertex& c = grid[(i + 1) * (segments + 1) + j + 1];
+			const Vertex& d = grid[i * (segments + 1) + j + 1];
+			triangles.push_back(new (storage + triangles.size()) Triangle(a, b, c, mat));
+			triangles.push_back(new (storage + triangles.size()) Triangle(a, c, d, mat));
+		}
+	}
+	memory.own_array(storage, triangles.size());
+}
+
+// builds the mesh tree with spatial splits, as `mesh path sbvh` would without
+// a cache, and sets it on a floor under an area light. a tree with object
+// splits only is built and dropped first, for the sah cost the splits save.
+void mesh_benchmark(const string& name, vector<Triangle*>& triangles, benchmark_scene& b) {
+	arena& memory = b.description.memory;
+	b.name = name;
+	b.primitives = long(triangles.size());
+	{
+		sbvh object_tree(triangles.data(), int(triangles.size()), 1.0f);
+		b.object_sah_cost = object_tree.sah_cost();
+	}
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	sbvh* tree = memory.make<sbvh>(triangles.data(), int(triangles.size()), 1.5f);
+	b.build_seconds = benchmark_seconds(start);
+	b.mesh = tree;
+	b.references = tree->reference_count();
+	b.sah_cost = tree->sah_cost();
+
+	aabb box;
+	tree->bounding_box(0, 1, box);
+	vec3 center = 0.5f * (box.min() + box.max());
+	float radius = 0.5f * (box.max() - box.min()).length();
+	material* white = memory.make<lambertian>(memory.make<constant_texture>(vec3(0.73f, 0.73f, 0.73f)));
+	material* light = memory.make<diffuse_light>(memory.make<constant_texture>(vec3(15, 15, 15)));
+	float x0 = center.x() - 0.5f * radius, x1 = center.x() + 0.5f * radius;
+	float z0 = center.z() - 0.5f * radius, z1 = center.z() + 0.5f * radius;
+	float y = box.max().y() + radius;
+	hittable* list[3];
+	list[0] = tree;
+	list[1] = memory.make<xz_rect>(center.x() - 4 * radius, center.x() + 4 * radius, center.z() - 4 * radius, center.z() + 4 * radius, box.min().y(), white);
+	list[2] = memory.make<flip_normals>(memory.make<xz_rect>(x0, x1, z0, z1, y, light));
+	b.description.world = finalize_scene(list, 3, memory);
+	b.description.light_shape = memory.make<xz_rect>(x0, x1, z0, z1, y, (material*)0);
+	b.description.view.lookfrom = center + radius * vec3(0.6f, 0.5f, 2.8f);
+	b.description.view.lookat = center;
+}
+
+// a grid of small spheres of mixed materials on a huge ground sphere
+void spheres_benchmark(int n, benchmark_scene& b) {
+	arena& memory = b.description.memory;
+	b.name = "spheres";
+	seed_random(7);
+	vector<hittable*> spheres;
+	spheres.push_back(memory.make<sphere>(vec3(0, -1000, 0), 1000, memory.make<lambertian>(memory.make<constant_texture>(vec3(0.5f, 0.5f, 0.5f)))));
+	for (int a = -n / 2; a < n / 2; a++) {
+		for (int c = -n / 2; c < n / 2; c++) {
+			vec3 center(a + 0.9f * float(random_double()), 0.2f, c + 0.9f * float(random_double()));
+			double choice = random_double();
+			material* mat;
+			if (choice < 0.8)
+				mat = memory.make<lambertian>(memory.make<constant_texture>(vec3(float(random_double()), float(random_double()), float(random_double()))));
+			else if (choice < 0.95)
+				mat = memory.make<metal>(vec3(0.5f, 0.5f, 0.5f) + 0.5f * vec3(float(random_double()), float(random_double()), float(random_double())), 0.5f * float(random_double()));
+			else
+				mat = memory.make<dielectric>(1.5f);
+			spheres.push_back(memory.make<sphere>(center, 0.2f, mat));
+		}
+	}
+	material* light = memory.make<diffuse_light>(memory.make<constant_texture>(vec3(10, 10, 10)));
+	spheres.push_back(memory.make<flip_normals>(memory.make<xz_rect>(-10, 10, -10, 10, 20, light)));
+	b.primitives = long(n) * n + 1;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	b.description.world = finalize_scene(spheres.data(), int(spheres.size()), memory);
+	b.build_seconds = benchmark_seconds(start);
+	b.description.light_shape = memory.make<xz_rect>(-10, 10, -10, 10, 20, (material*)0);
+	b.description.view.lookfrom = vec3(13, 2, 3);
+	b.description.view.lookat = vec3(0, 0, 0);
+	b.description.view.vfov = 30;
+}
+
+// measurements
+// ------------
+// casts the batch until min_seconds have passed, on the calling thread. ray i
+// stops at t_max[i]
+ray_rate time_rays(const hittable* world, const vector<ray>& rays, const vector<float>& t_max, double min_seconds) {
+	ray_rate rate = { 0, 0, 0 };
+	if (rays.empty())
+		return rate;
+	uint64_t nodes = local_stat(stat_bvh_nodes);
+	size_t cast = 0, hits = 0;
+	double seconds;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	do {
+		hit_record rec;
+		for (size_t i = 0; i < rays.size(); i++)
+			hits += world->hit(rays[i], 0.001f, t_max[i], rec);
+		cast += rays.size();
+		seconds = benchmark_seconds(start);
+	} while (seconds < min_seconds);
+	rate.per_second = cast / seconds;
+	rate.hit_fraction = double(hits) / cast;
+	rate.nodes_per_ray = double(local_stat(stat_bvh_nodes) - nodes) / cast;
+	return rate;
+}
+
+struct ray_batches {
+	vector<ray> primary, secondary, shadow;
+	vector<float> shadow_t_max;	// just short of the point on the light, so shadow hits are occluders
+};
+
+// one camera ray per pixel, then a diffuse bounce and a light probe from
+// every point they hit
+ray_batches make_ray_batches(camera* cam, const hittable* world, hittable* light_shape, int nx, int ny) {
+	ray_batches batches;
+	seed_random(1);
+	for (int y = 0; y < ny; y++) {
+		for (int x = 0; x < nx; x++)
+			batches.primary.push_back(cam->get_ray((x + float(random_double())) / nx, (y + float(random_double())) / ny));
+	}
+	for (size_t i = 0; i < batches.primary.size(); i++) {
+		const ray& r = batches.primary[i];
+		hit_record rec;
+		if (!world->hit(r, 0.001f, FLT_MAX, rec))
+			continue;
+		vec3 normal = dot(rec.normal, r.direction()) > 0 ? -rec.normal : rec.normal;
+		batches.secondary.push_back(ray(rec.p, normal + random_in_unit_sphere(), r.time()));
+		if (light_shape) {
+			// the direction is normalized, so the ray keeps the distance
+			vec3 to_light = light_shape->random(rec.p);
+			batches.shadow.push_back(ray(rec.p, to_light, r.time()));
+			batches.shadow_t_max.push_back(0.999f * to_light.length());
+		}
+	}
+	return batches;
+}
+
+benchmark_result run_benchmark(benchmark_scene& b, const benchmark_options& options) {
+	benchmark_result result;
+	result.name = b.name;
+	result.primitives = b.primitives;
+	result.build_seconds = b.build_seconds;
+	result.node_bytes = result.binary_node_bytes = 0;
+	result.references = b.references;
+	result.sah_cost = b.sah_cost;
+	result.object_sah_cost = b.object_sah_cost;
+	b.description.nx = options.nx;
+	b.description.ny = options.ny;
+	camera* cam = b.description.make_camera();
+	hittable* world = b.description.world;
+	hittable* light_shape = b.description.light_shape;
+
+	ray_batches batches = make_ray_batches(cam, world, light_shape, options.nx, options.ny);
+	vector<float> unbounded(max(batches.primary.size(), batches.secondary.size()), FLT_MAX);
+	if (b.mesh) {
+		result.binary_node_bytes = b.mesh->node_memory();
+		result.binary_primary = time_rays(world, batches.primary, unbounded, options.min_seconds);
+		result.binary_secondary = time_rays(world, batches.secondary, unbounded, options.min_seconds);
+		result.binary_shadow = time_rays(world, batches.shadow, batches.shadow_t_max, options.min_seconds);
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		b.mesh->compress();
+		result.build_seconds += benchmark_seconds(start);
+		result.node_bytes = b.mesh->node_memory();
+	}
+	result.primary = time_rays(world, batches.primary, unbounded, options.min_seconds);
+	result.secondary = time_rays(world, batches.secondary, unbounded, options.min_seconds);
+	result.shadow = time_rays(world, batches.shadow, batches.shadow_t_max, options.min_seconds);
+
+	render_settings settings;
+	settings.threads = options.threads;
+	framebuffer image(options.nx, options.ny);
+	flush_stats();
+	stats_totals& totals = global_stats();
+	uint64_t rays_before = totals.counters[stat_camera_rays] + totals.counters[stat_secondary_rays] + totals.counters[stat_shadow_rays];
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (int pass = 0; pass < options.ns; pass++)
+		render_pass(cam, world, light_shape, b.description.environment, settings, pass, image, 0, 0);
+	double seconds = benchmark_seconds(start);
+	flush_stats();
+	uint64_t rays = totals.counters[stat_camera_rays] + totals.counters[stat_secondary_rays] + totals.counters[stat_shadow_rays] - rays_before;
+	result.samples_per_second = double(options.nx) * options.ny * options.ns / seconds;
+	result.render_rays_per_second = rays / seconds;
+	result.peak_memory = process_peak_memory();
+	delete cam;
+	return result;
+}
+
+// relative mean squared error of a render, less the part the noise of the
+// reference itself adds in expectation
+double relative_error(const vector<vec3>& pixels, const framebuffer& reference) {
+	double sum = 0;
+	for (int y = 0; y < reference.ny; y++) {
+		for (int x = 0; x < reference.nx; x++) {
+			vec3 r = reference.mean(x, y);
+			vec3 v = reference.variance(x, y) / float(reference.sample_count());
+			for (int k = 0; k < 3; k++) {
+				double difference = pixels[y * reference.nx + x][k] - r[k];
+				sum += (difference * difference - v[k]) / (double(r[k]) * r[k] + 0.01);
+			}
+		}
+	}
+	return sum / (3.0 * reference.nx * reference.ny);
+}
+
+// the error of plain monte carlo falls as one over the samples, so the
+// unfiltered render matches the denoised error at spp * raw / denoised.
+// sample counts above a quarter of the reference are skipped.
+bool run_denoise_study(const benchmark_options& options, denoise_study& study) {
+	study.nx = study.ny = 128;
+	study.reference_spp = options.denoise_reference_spp;
+	benchmark_scene b;
+	if (!cornell_benchmark(options, b))
+		return false;
+	b.description.nx = study.nx;
+	b.description.ny = study.ny;
+	camera* cam = b.description.make_camera();
+	render_settings settings;
+	settings.threads = options.threads;
+	// another seed, so the reference shares no samples with the renders
+	settings.seed = 1;
+	framebuffer reference(study.nx, study.ny);
+	for (int pass = 0; pass < study.reference_spp; pass++)
+		render_pass(cam, b.description.world, b.description.light_shape, b.description.environment, settings, pass, reference, 0, 0);
+	settings.seed = 0;
+	const int counts[] = { 4, 16, 64 };
+	for (int i = 0; i < int(sizeof(counts) / sizeof(counts[0])) && 4 * counts[i] <= study.reference_spp; i++) {
+		framebuffer image(study.nx, study.ny);
+		aov_buffer aovs(study.nx, study.ny);
+		for (int pass = 0; pass < counts[i]; pass++)
+			render_pass(cam, b.description.world, b.description.light_shape, b.description.environment, settings, pass, image, 0, &aovs);
+		vector<vec3> raw(study.nx * study.ny);
+		for (int y = 0; y < study.ny; y++) {
+			for (int x = 0; x < study.nx; x++)
+				raw[y * study.nx + x] = image.mean(x, y);
+		}
+		denoise_settings filter;
+		filter.threads = options.threads;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		vector<vec3> denoised = denoise(image, aovs, filter);
+		denoise_level level;
+		level.seconds = benchmark_seconds(start);
+		level.spp = counts[i];
+		level.raw_error = relative_error(raw, reference);
+		level.denoised_error = relative_error(denoised, reference);
+		level.equal_error_spp = level.denoised_error > 0 ? counts[i] * level.raw_error / level.denoised_error : 0;
+		study.levels.push_back(level);
+	}
+	delete cam;
+	return true;
+}
+
+// accuracy
+// --------
+struct attribute_accuracy {
+	double normal_max_degrees, normal_mean_degrees;	// octahedral round trips
+	double uv_max_error;	// half float round trips of uvs in [0, 1]
+	bool half_exact;	// every half survives half_to_float and float_to_half
+};
+
+// angle between unit vectors in doubles, stable for the tiny angles here
+double angle_degrees(const vec3& a, const vec3& b) {
+	double ax = a.x(), ay = a.y(), az = a.z(), bx = b.x(), by = b.y(), bz = b.z();
+	double cx = ay * bz - az * by, cy = az * bx - ax * bz, cz = ax * by - ay * bx;
+	return atan2(sqrt(cx * cx + cy * cy + cz * cz), ax * bx + ay * by + az * bz) * 180 / M_PI;
+}
+
+// a million random directions plus the axes, the diagonals and the fold of
+// the octahedron at z = 0, where rounding can flip a normal to the other half
+attribute_accuracy measure_attribute_accuracy() {
+	vector<vec3> normals;
+	for (int a = 0; a < 3; a++) {
+		for (int sign = -1; sign <= 1; sign += 2) {
+			vec3 n(0, 0, 0);
+			n[a] = float(sign);
+			normals.push_back(n);
+		}
+	}
+	for (int i = 0; i < 8; i++)
+		normals.push_back(unit_vector(vec3(i & 1 ? -1.0f : 1.0f, i & 2 ? -1.0f : 1.0f, i & 4 ? -1.0f : 1.0f)));
+	for (int i = 0; i < 4096; i++) {
+		float phi = float(2 * M_PI * i / 4096);
+		float z = (i & 1 ? -1 : 1) * (i % 3 == 0 ? 0.0f : 1e-4f * (i % 7));
+		normals.push_back(unit_vector(vec3(cos(phi), sin(phi), z)));
+	}
+	seed_random(49);
+	for (int i = 0; i < 1 << 20; i++) {
+		float z = float(2 * random_double() - 1);
+		float phi = float(2 * M_PI * random_double());
+		float r = sqrt(ffmax(0.0f, 1 - z * z));
+		normals.push_back(vec3(r * cos(phi), r * sin(phi), z));
+	}
+	attribute_accuracy accuracy = { 0, 0, 0, true };
+	for (size_t i = 0; i < normals.size(); i++) {
+		double error = angle_degrees(normals[i], decode_octahedral(encode_octahedral(normals[i])));
+		accuracy.normal_max_degrees = max(accuracy.normal_max_degrees, error);
+		accuracy.normal_mean_degrees += error / normals.size();
+	}
+	for (int i = 0; i <= 1 << 20; i++) {
+		float u = float(i) / (1 << 20);
+		accuracy.uv_max_error = max(accuracy.uv_max_error, double(fabs(half_to_float(float_to_half(u)) - u)));
+	}
+	for (uint32_t h = 0; h < 65536; h++) {
+		bool nan = (h & 0x7c00) == 0x7c00 && (h & 0x3ff);
+		if (!nan && float_to_half(half_to_float(uint16_t(h))) != h)
+			accuracy.half_exact = false;
+	}
+	return accuracy;
+}
+
+// the largest relative error of fast_rsqrt, one lane at a time and four or
+// eight at once. every float in [1, 4) covers both estimate tables, other
+// exponents scale them exactly, which random values over the whole range
+// confirm.
+double measure_rsqrt_error() {
+	vector<float> values;
+	for (uint32_t bits = 0x3f800000u; bits < 0x40800000u; bits++) {
+		float x;
+		memcpy(&x, &bits, sizeof(x));
+		values.push_back(x);
+	}
+	seed_random(33);
+	for (int i = 0; i < 1 << 16; i++)
+		values.push_back(float(pow(10.0, 60 * random_double() - 30)));
+	double error = 0;
+	for (size_t i = 0; i + floatx8::width <= values.size(); i += floatx8::width) {
+		float lanes4[floatx8::width], lanes8[floatx8::width];
+		fast_rsqrt(floatx4::load(&values[i])).store(lanes4);
+		fast_rsqrt(floatx4::load(&values[i + 4])).store(lanes4 + 4);
+		fast_rsqrt(floatx8::load(&values[i])).store(lanes8);
+		for (int k = 0; k < floatx8::width; k++) {
+			double exact = 1 / sqrt(double(values[i + k]));
+			error = max(error, fabs(fast_rsqrt(values[i + k]) - exact) / exact);
+			error = max(error, fabs(lanes4[k] - exact) / exact);
+			error = max(error, fabs(lanes8[k] - exact) / exact);
+		}
+	}
+	return error;
+}
+
+// transforms
+// ----------
+struct transform_check {
+	int rays, hits;
+	int disagreements;	// rays one of the two hits and the other misses
+	double t_max_error;	// relative to the distance
+	double normal_max_error;	// between unit normals
+	bool flattened;
+};
+
+// a box under translate, rotate_y, a general transform with a tilted
+// rotation and a non uniform scale, rotate_y and translate again, against
+// flatten_transforms of the same chain. rays start all around the box and
+// aim near it, so about half of them hit, some at grazing angles.
+transform_check check_transform_flattening() {
+	transform_check check = { 0, 0, 0, 0, 0, false };
+	arena memory;
+	hittable* shape = memory.make<box>(vec3(-1, -0.5f, -2), vec3(1, 0.5f, 2), (material*)0);
+	hittable* nested = memory.make<rotate_y>(shape, 30);
+	nested = memory.make<translate>(nested, vec3(0.5f, 0, -1));
+	nested = memory.make< ::transform>(nested, affine::rotation(unit_vector(vec3(1, 1, 0)), 40) * affine::scaling(vec3(1.5f, 0.8f, 1.2f)));
+	nested = memory.make<rotate_y>(nested, -70);
+	nested = memory.make<translate>(nested, vec3(2, 1, -3));
+	hittable* flat = flatten_transforms(nested, memory);
+	affine to_world;
+	check.flattened = flat != nested && flat->as_transform(to_world) == shape;
+	aabb bounds;
+	nested->bounding_box(0, 1, bounds);
+	vec3 center = 0.5f * (bounds.min() + bounds.max());
+	float size = (bounds.max() - bounds.min()).length();
+	seed_random(30);
+	for (int i = 0; i < 1 << 16; i++) {
+		vec3 origin = center + 2 * size * unit_vector(random_in_unit_sphere());
+		vec3 target = center + 0.2f * size * random_in_unit_sphere();
+		ray r(origin, target - origin);
+		hit_record a, b;
+		bool hit_nested = nested->hit(r, 0.001f, FLT_MAX, a);
+		bool hit_flat = flat->hit(r, 0.001f, FLT_MAX, b);
+		check.rays++;
+		if (hit_nested != hit_flat)
+			check.disagreements++;
+		if (!hit_nested || !hit_flat)
+			continue;
+		check.hits++;
+		check.t_max_error = max(check.t_max_error, double(fabs(a.t - b.t) / a.t));
+		check.normal_max_error = max(check.normal_max_error, double((unit_vector(a.normal) - unit_vector(b.normal)).length()));
+	}
+	return check;
+}
+
+// shadow rays
+// -----------
+struct shadow_check {
+	int rays;
+	int occluded;	// stop at an occluder before the light
+	int reach;	// hit something when they run past the light, occluder or light
+};
+
+// the shadow batch of the cornell box. the boxes shade part of the room, so
+// some rays are occluded, and every ray runs into the light just past its
+// limit unless something blocks it earlier.
+bool check_shadow_rays(const benchmark_options& options, shadow_check& check) {
+	check.rays = check.occluded = check.reach = 0;
+	scene description;
+	if (!load_scene(options.resources + "cornell.scene", description) || !description.light_shape)
+		return false;
+	description.nx = description.ny = 64;
+	camera* cam = description.make_camera();
+	ray_batches batches = make_ray_batches(cam, description.world, description.light_shape, description.nx, description.ny);
+	delete cam;
+	for (size_t i = 0; i < batches.shadow.size(); i++) {
+		hit_record rec;
+		float t_max = batches.shadow_t_max[i];
+		check.rays++;
+		check.occluded += description.world->hit(batches.shadow[i], 0.001f, t_max, rec);
+		check.reach += description.world->hit(batches.shadow[i], 0.001f, t_max * (1.002f / 0.999f), rec);
+	}
+	return true;
+}
+
+// tiled textures
+// --------------
+struct texture_cache_check {
+	double level0_max_error;	// against image_texture, which filters the same texels
+	double mip_max_error;	// the pyramids round differently
+	texture_cache_stats stats;
+	bool reopened;	// the converted file is found again instead of rebuilt
+};
+
+// a noisy 300 x 200 image is 5 x 4 tiles at level 0 and the budget holds one
+// tile per shard, so random lookups keep evicting. the image and its tiles are
+// written next to the results and removed again.
+texture_cache_check check_texture_cache(const benchmark_options& options) {
+	texture_cache_check check = { 0, 0, texture_cache_stats(), false };
+	const int nx = 300, ny = 200;
+	vector<unsigned char> pixels(3 * nx * ny);
+	seed_random(37);
+	for (size_t i = 0; i < pixels.size(); i++)
+		pixels[i] = (unsigned char)(256 * random_double());
+	string image_path = options.output_path + ".texture.png";
+	if (!stbi_write_png(image_path.c_str(), nx, ny, 3, pixels.data(), 3 * nx))
+		return check;
+	image_texture reference(pixels.data(), nx, ny, true);
+	arena memory;
+	texture_cache cache(texture_cache_shards * texture_file_tile_bytes);
+	texture* tiled = load_tiled_texture(cache, image_path, true, memory);
+	if (tiled) {
+		vec3 p(0, 0, 0);
+		for (int i = 0; i < 1 << 16; i++) {
+			float u = float(random_double()), v = float(random_double());
+			float width = float(random_double() * 0.1);
+			vec3 a = tiled->value(u, v, p) - reference.value(u, v, p);
+			vec3 b = tiled->value(u, v, p, width) - reference.value(u, v, p, width);
+			for (int k = 0; k < 3; k++) {
+				check.level0_max_error = max(check.level0_max_error, double(fabs(a[k])));
+				check.mip_max_error = max(check.mip_max_error, double(fabs(b[k])));
+			}
+		}
+		check.stats = cache.stats();
+		check.reopened = cache.open(image_path + ".tex", texture_file_key(image_path, true)) >= 0;
+	}
+	remove(image_path.c_str());
+	remove((image_path + ".tex").c_str());
+	return check;
+}
+
+// report
+// ------
+void write_rate(ostream& out, const char* name, const ray_rate& rate) {
+	out << "      \"" << name << "\": {\"rays_per_second\": " << rate.per_second << ", \"hit_fraction\": " << rate.hit_fraction
+		<< ", \"bvh_nodes_per_ray\": " << rate.nodes_per_ray << "},\n";
+}
+
+bool write_results(const string& path, const benchmark_options& options, const attribute_accuracy& accuracy,
+	const vector<benchmark_result>& results, const denoise_study& study) {
+	ofstream out(path);
+	if (!out)
+		return false;
+	out << setprecision(6);
+	out << "{\n  \"label\": ";
+	trace_write_string(out, options.label);
+	out << ",\n  \"width\": " << options.nx << ",\n  \"height\": " << options.ny << ",\n  \"spp\": " << options.ns
+		<< ",\n  \"threads\": " << options.threads << ",\n  \"render_stats\": " << RENDER_STATS
+		<< ",\n  \"compact_normals\": " << RENDER_COMPACT_NORMALS << ",\n  \"half_uvs\": " << RENDER_HALF_UVS
+		<< ",\n  \"normal_max_error_degrees\": " << accuracy.normal_max_degrees
+		<< ",\n  \"normal_mean_error_degrees\": " << accuracy.normal_mean_degrees
+		<< ",\n  \"uv_max_error\": " << accuracy.uv_max_error << ",\n  \"scenes\": [\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		const benchmark_result& r = results[i];
+		out << "    {\n      \"name\": ";
+		trace_write_string(out, r.name);
+		out << ",\n";
+		if (r.primitives >= 0)
+			out << "      \"primitives\": " << r.primitives << ",\n";
+		out << "      \"build_seconds\": " << r.build_seconds << ",\n";
+		write_rate(out, "primary", r.primary);
+		write_rate(out, "secondary", r.secondary);
+		write_rate(out, "shadow", r.shadow);
+		if (r.node_bytes > 0) {
+			out << "      \"node_bytes\": " << r.node_bytes << ",\n";
+			out << "      \"binary_node_bytes\": " << r.binary_node_bytes << ",\n";
+			out << "      \"references\": " << r.references << ",\n";
+			out << "      \"sah_cost\": " << r.sah_cost << ",\n";
+			out << "      \"object_split_sah_cost\": " << r.object_sah_cost << ",\n";
+			write_rate(out, "binary_primary", r.binary_primary);
+			write_rate(out, "binary_secondary", r.binary_secondary);
+			write_rate(out, "binary_shadow", r.binary_shadow);
+		}
+		out << "      \"samples_per_second\": " << r.samples_per_second << ",\n"
+			<< "      \"render_rays_per_second\": " << r.render_rays_per_second << ",\n"
+			<< "      \"peak_memory_bytes\": " << r.peak_memory << "\n    }" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "  ]";
+	if (!study.levels.empty()) {
+		out << ",\n  \"denoise\": {\n    \"scene\": \"cornell\",\n    \"width\": " << study.nx << ",\n    \"height\": " << study.ny
+			<< ",\n    \"reference_spp\": " << study.reference_spp << ",\n    \"levels\": [\n";
+		for (size_t i = 0; i < study.levels.size(); i++) {
+			const denoise_level& l = study.levels[i];
+			out << "      {\"spp\": " << l.spp << ", \"raw_rel_mse\": " << l.raw_error << ", \"denoised_rel_mse\": " << l.denoised_error
+				<< ", \"equal_error_spp\": " << l.equal_error_spp << ", \"spp_saving\": " << l.equal_error_spp / l.spp
+				<< ", \"denoise_seconds\": " << l.seconds << "}" << (i + 1 < study.levels.size() ? "," : "") << "\n";
+		}
+		out << "    ]\n  }";
+	}
+	out << "\n}\n";
+	return bool(out);
+}
+
+// the number after "key": at or after from, for reading back our own output
+double json_number(const string& text, size_t from, size_t to, const string& key) {
+	size_t at = text.find("\"" + key + "\":", from);
+	if (at == string::npos || at >= to)
+		return 0;
+	return strtod(text.c_str() + at + key.size() + 3, 0);
+}
+
+// reads results written by write_results, only what the comparison needs
+bool read_results(const string& path, vector<benchmark_result>& results) {
+	ifstream in(path);
+	if (!in)
+		return false;
+	string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+	size_t at = text.find("\"scenes\"");
+	while (at != string::npos && (at = text.find("\"name\": \"", at)) != string::npos) {
+		size_t end = text.find("\"name\": \"", at + 1);
+		if (end == string::npos)
+			end = text.size();
+		benchmark_result r;
+		size_t name = at + 9;
+		r.name = text.substr(name, text.find('"', name) - name);
+		r.build_seconds = json_number(text, at, end, "build_seconds");
+		const char* rates[3] = { "primary", "secondary", "shadow" };
+		ray_rate* targets[3] = { &r.primary, &r.secondary, &r.shadow };
+		for (int i = 0; i < 3; i++) {
+			size_t rate = text.find(string("\"") + rates[i] + "\"", at);
+			targets[i]->per_second = rate < end ? json_number(text, rate, end, "rays_per_second") : 0;
+		}
+		r.samples_per_second = json_number(text, at, end, "samples_per_second");
+		results.push_back(r);
+		at = end == text.size() ? string::npos : end;
+	}
+	return true;
+}
+
+// speedups over the baseline, above 1 is faster
+void print_speedups(ostream& out, const vector<benchmark_result>& baseline, const vector<benchmark_result>& results) {
+	out << "speedup over baseline   build  primary  secondary  shadow  samples" << endl;
+	for (size_t i = 0; i < results.size(); i++) {
+		const benchmark_result& r = results[i];
+		for (size_t j = 0; j < baseline.size(); j++) {
+			const benchmark_result& b = baseline[j];
+			if (b.name != r.name)
+				continue;
+			double ratios[5] = { r.build_seconds > 0 ? b.build_seconds / r.build_seconds : 0,
+				b.primary.per_second > 0 ? r.primary.per_second / b.primary.per_second : 0,
+				b.secondary.per_second > 0 ? r.secondary.per_second / b.secondary.per_second : 0,
+				b.shadow.per_second > 0 ? r.shadow.per_second / b.shadow.per_second : 0,
+				b.samples_per_second > 0 ? r.samples_per_second / b.samples_per_second : 0 };
+			int widths[5] = { 7, 9, 11, 8, 9 };
+			out << "  " << left << setw(20) << r.name << right << fixed << setprecision(3);
+			for (int k = 0; k < 5; k++)
+				out << setw(widths[k]) << ratios[k];
+			out << endl;
+			out.unsetf(ios::fixed);
+		}
+	}
+}
+
+void print_benchmark_usage(const char* program) {
+	cerr << "usage: " << program << " [options]\n"
+		<< "  --output PATH       json results (default benchmark.json)\n"
+		<< "  --resources DIR     where cornell.scene and the obj files are (default resources/)\n"
+		<< "  --label TEXT        copied to the results, e.g. the commit\n"
+		<< "  --only NAME         run the scenes whose name contains NAME, denoise is the\n"
+		<< "                      denoiser rating\n"
+		<< "  --width N           image width (default 256)\n"
+		<< "  --height N          image height (default 256)\n"
+		<< "  --spp N             samples per pixel of the end to end render (default 4)\n"
+		<< "  --threads N         render threads (default all cores)\n"
+		<< "  --min-time SEC      shortest time per ray batch (default 0.5)\n"
+		<< "  --denoise-reference-spp N  samples of the reference the denoiser is rated\n"
+		<< "                      against, 0 skips the rating (default 1024)\n"
+		<< "  --baseline PATH     print speedups over an earlier results file\n"
+		<< "  --checks            only run the accuracy checks, exit 1 if one fails\n";
+}
+
+bool parse_benchmark_options(int argc, char** argv, benchmark_options& options) {
+	for (int i = 1; i < argc; i++) {
+		string option = argv[i];
+		if (option == "--checks") {
+			options.checks_only = true;
+			continue;
+		}
+		if (option == "--help" || option == "-h" || i + 1 >= argc)
+			return false;
+		const char* value = argv[++i];
+		char* end = 0;
+		bool ok = true;
+		if (option == "--output")
+			options.output_path = value;
+		else if (option == "--resources")
+			options.resources = string(value) + "/";
+		else if (option == "--label")
+			options.label = value;
+		else if (option == "--only")
+			options.only = value;
+		else if (option == "--baseline")
+			options.baseline_path = value;
+		else if (option == "--width")
+			ok = (options.nx = int(strtol(value, &end, 10))) > 0;
+		else if (option == "--height")
+			ok = (options.ny = int(strtol(value, &end, 10))) > 0;
+		else if (option == "--spp")
+			ok = (options.ns = int(strtol(value, &end, 10))) > 0;
+		else if (option == "--threads")
+			ok = (options.threads = int(strtol(value, &end, 10))) > 0;
+		else if (option == "--min-time")
+			ok = (options.min_seconds = strtod(value, &end)) >= 0;
+		else if (option == "--denoise-reference-spp")
+			ok = (options.denoise_reference_spp = int(strtol(value, &end, 10))) >= 0;
+		else {
+			cerr << "unknown option " << option << endl;
+			return false;
+		}
+		if (!ok || (end && *end)) {
+			cerr << "bad value for " << option << ": " << value << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	benchmark_options options;
+	if (!parse_benchmark_options(argc, argv, options)) {
+		print_benchmark_usage(argv[0]);
+		return 1;
+	}
+	vector<benchmark_result> baseline;
+	if (!options.baseline_path.empty() && !read_results(options.baseline_path, baseline)) {
+		cerr << "cannot read baseline " << options.baseline_path << endl;
+		return 1;
+	}
+	// the encodings the meshes shade with, before anything is timed
+	attribute_accuracy accuracy = measure_attribute_accuracy();
+	cerr << "octahedral normals: max error " << accuracy.normal_max_degrees << " degrees, mean "
+		<< accuracy.normal_mean_degrees << "; half uvs: max error " << accuracy.uv_max_error << endl;
+	if (!(accuracy.normal_max_degrees <= octahedral_max_error) || !(accuracy.uv_max_error <= half_uv_max_error) || !accuracy.half_exact) {
+		cerr << "attribute encodings exceed their bounds of " << octahedral_max_error << " degrees and "
+			<< half_uv_max_error << (accuracy.half_exact ? "" : ", or halves do not round trip") << endl;
+		return 1;
+	}
+	double rsqrt_error = measure_rsqrt_error();
+	cerr << "fast_rsqrt: max relative error " << rsqrt_error << endl;
+	if (!(rsqrt_error <= fast_rsqrt_max_error)) {
+		cerr << "fast_rsqrt exceeds its bound of " << fast_rsqrt_max_error << endl;
+		return 1;
+	}
+	transform_check transforms = check_transform_flattening();
+	cerr << "flattened transforms: " << transforms.hits << " of " << transforms.rays << " rays hit, " << transforms.disagreements
+		<< " disagree; max error " << transforms.t_max_error << " in t, " << transforms.normal_max_error << " in the normal" << endl;
+	if (!transforms.flattened || transforms.hits < transforms.rays / 4 || transforms.disagreements > transforms.rays / 1000
+		|| !(transforms.t_max_error <= 1e-4) || !(transforms.normal_max_error <= 1e-4)) {
+		cerr << "the flattened transform differs from the chain it replaces" << endl;
+		return 1;
+	}
+	shadow_check shadows;
+	if (!check_shadow_rays(options, shadows)) {
+		cerr << "cannot read " << options.resources << "cornell.scene" << endl;
+		return 1;
+	}
+	cerr << "shadow rays: " << shadows.occluded << " of " << shadows.rays << " occluded, " << shadows.reach << " reach the light or an occluder" << endl;
+	if (shadows.rays == 0 || shadows.occluded < shadows.rays / 20 || shadows.occluded > shadows.rays * 19 / 20 || shadows.reach < shadows.rays * 19 / 20) {
+		cerr << "shadow rays stop short of the light or are all alike" << endl;
+		return 1;
+	}
+	texture_cache_check tiles = check_texture_cache(options);
+	cerr << "tiled textures: max error " << tiles.level0_max_error << ", mipmapped " << tiles.mip_max_error << "; ";
+	cerr << tiles.stats.evictions << " tiles evicted, peak " << tiles.stats.peak / 1024 << " of " << tiles.stats.budget / 1024 << " KB" << endl;
+	if (!(tiles.level0_max_error <= 1e-6) || !(tiles.mip_max_error <= 2.0 / 255) || tiles.stats.evictions == 0
+		|| tiles.stats.peak > tiles.stats.budget || !tiles.reopened) {
+		cerr << "the texture cache differs from image textures, does not evict or exceeds its budget" << endl;
+		return 1;
+	}
+	if (options.checks_only)
+		return 0;
+	// mesh_x benchmarks resources/x.obj
+	const char* names[] = { "cornell", "mesh_sphere", "mesh_cylinder", "mesh_cone", "spheres", "torus_1m" };
+	vector<benchmark_result> results;
+	for (int i = 0; i < int(sizeof(names) / sizeof(names[0])); i++) {
+		string name = names[i];
+		if (name.find(options.only) == string::npos)
+			continue;
+		cerr << "benchmark " << name << endl;
+		benchmark_scene b;
+		material* grey = b.description.memory.make<lambertian>(b.description.memory.make<constant_texture>(vec3(0.6f, 0.6f, 0.6f)));
+		vector<Triangle*> triangles;
+		if (name == "cornell") {
+			if (!cornell_benchmark(options, b))
+				return 1;
+		}
+		else if (name == "spheres")
+			spheres_benchmark(100, b);
+		else if (name == "torus_1m") {
+			torus_triangles(500, 1000, grey, triangles, b.description.memory);
+			mesh_benchmark(name, triangles, b);
+		}
+		else {
+			string path = options.resources + name.substr(5) + ".obj";
+			if (!obj_triangles(path, grey, triangles, b.description.memory)) {
+				cerr << "cannot read " << path << endl;
+				return 1;
+			}
+			mesh_benchmark(name, triangles, b);
+		}
+		results.push_back(run_benchmark(b, options));
+		const benchmark_result& r = results.back();
+		cerr << "  build " << r.build_seconds << "s, primary " << r.primary.per_second / 1e6 << " Mrays/s, secondary "
+			<< r.secondary.per_second / 1e6 << " Mrays/s, shadow " << r.shadow.per_second / 1e6 << " Mrays/s, "
+			<< r.samples_per_second / 1e6 << " Msamples/s" << endl;
+		if (r.node_bytes > 0) {
+			cerr << "  nodes " << r.node_bytes / 1048576.0 << " MB, binary " << r.binary_node_bytes / 1048576.0 << " MB with primary "
+				<< r.binary_primary.per_second / 1e6 << " Mrays/s, secondary " << r.binary_secondary.per_second / 1e6
+				<< " Mrays/s, shadow " << r.binary_shadow.per_second / 1e6 << " Mrays/s" << endl;
+			cerr << "  " << r.references << " references, sah cost " << r.sah_cost << " (object splits only: " << r.object_sah_cost << ")" << endl;
+		}
+	}
+	denoise_study study;
+	if (options.denoise_reference_spp > 0 && string("denoise").find(options.only) != string::npos) {
+		cerr << "benchmark denoise" << endl;
+		if (!run_denoise_study(options, study))
+			return 1;
+		for (size_t i = 0; i < study.levels.size(); i++) {
+			const denoise_level& l = study.levels[i];
+			cerr << "  " << l.spp << " spp denoised in " << l.seconds << "s matches " << l.equal_error_spp << " spp unfiltered ("
+				<< l.equal_error_spp / l.spp << "x), rel mse " << l.denoised_error << " against " << l.raw_error << endl;
+		}
+	}
+	if (!write_results(options.output_path, options, accuracy, results, study)) {
+		cerr << "cannot write " << options.output_path << endl;
+		return 1;
+	}
+	if (!baseline.empty())
+		print_speedups(cout, baseline, results);
+	return 0;
+}
\ No newline at end of file
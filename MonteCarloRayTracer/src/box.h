@@ -12,24 +12,51 @@ public:
 
 private:
 	vec3 pmin, pmax;
-	hittable* list_ptr;
+	// the six faces by value, the back faces get their normals flipped
+	xy_rect xy[2];
+	xz_rect xz[2];
+	yz_rect yz[2];
 };
 
 box::box(const vec3& p0, const vec3& p1, material* ptr) {
 	pmin = p0;
 	pmax = p1;
-	hittable** list = new hittable* [6];
-	list[0] = new xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), ptr);
-	list[1] = new flip_normals(new xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), ptr));
-	list[2] = new xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), ptr);
-	list[3] = new flip_normals(new xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), ptr));
-	list[4] = new yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), ptr);
-	list[5] = new flip_normals(new yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), ptr));
-	list_ptr = new hittable_list(list, 6);
+	xy[0] = xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), ptr);
+	xy[1] = xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), ptr);
+	xz[0] = xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), ptr);
+	xz[1] = xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), ptr);
+	yz[0] = yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), ptr);
+	yz[1] = yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), ptr);
 }
 
 bool box::hit(const ray& r, float t0, float t1, hit_record& rec) const {
-	return list_ptr->hit(r, t0, t1, rec);
+	hit_record temp_rec;
+	bool hit_anything = false;
+	float closest_so_far = t1;
+	for (int i = 0; i < 2; i++) {
+		if (xy[i].xy_rect::hit(r, t0, closest_so_far, temp_rec)) {
+			hit_anything = true;
+			closest_so_far = temp_rec.t;
+			rec = temp_rec;
+			if (i)
+				rec.normal = -rec.normal;
+		}
+		if (xz[i].xz_rect::hit(r, t0, closest_so_far, temp_rec)) {
+			hit_anything = true;
+			closest_so_far = temp_rec.t;
+			rec = temp_rec;
+			if (i)
+				rec.normal = -rec.normal;
+		}
+		if (yz[i].yz_rect::hit(r, t0, closest_so_far, temp_rec)) {
+			hit_anything = true;
+			closest_so_far = temp_rec.t;
+			rec = temp_rec;
+			if (i)
+				rec.normal = -rec.normal;
+		}
+	}
+	return hit_anything;
 }
 
 bool box::bounding_box(float t0, float t1, aabb& box) const {
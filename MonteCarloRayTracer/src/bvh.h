@@ -1,5 +1,8 @@
 #pragma once
+#include <vector>
+#include "arena.h"
 #include "hittable.h"
+#include "stats.h"
 
 int box_x_compare(const void* a, const void* b) {
 	aabb box_left, box_right;
@@ -40,7 +43,7 @@ int box_z_compare(const void* a, const void* b) {
 class bvh_node : public hittable {
 public:
 	bvh_node() {}
-	bvh_node(hittable** l, int n, float time0, float time1);
+	bvh_node(hittable** l, int n, float time0, float time1, arena& memory);
 	virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const override;
 	virtual bool bounding_box(float t0, float t1, aabb& box) const override;
 
@@ -50,10 +53,10 @@ private:
 	aabb box;
 };
 
-bvh_node::bvh_node(hittable** l, int n, float time0, float time1) {
-	aabb* boxes = new aabb[n];
-	float* left_area = new float[n];
-	float* right_area = new float[n];
+// the children come from memory, which has to outlive the tree
+bvh_node::bvh_node(hittable** l, int n, float time0, float time1, arena& memory) {
+	std::vector<aabb> boxes(n);
+	std::vector<float> left_area(n), right_area(n);
 	aabb main_box;
 	bool dummy = l[0]->bounding_box(time0, time1, main_box);
 	for (int i = 1; i < n; i++) {
@@ -100,14 +103,15 @@ bvh_node::bvh_node(hittable** l, int n, float time0, float time1) {
 		right = l[1];
 	}
 	else {
-		left = new bvh_node(l, n / 2, time0, time1);
-		right = new bvh_node(l + n / 2, n - n / 2, time0, time1);
+		left = memory.make<bvh_node>(l, n / 2, time0, time1, memory);
+		right = memory.make<bvh_node>(l + n / 2, n - n / 2, time0, time1, memory);
 	}
 
 	box = main_box;
 }
 
 bool bvh_node::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+	STAT_INC(stat_bvh_nodes);
 	if (box.hit(r, t_min, t_max)) {
 		hit_record left_rec, right_rec;
 		bool hit_left = left->hit(r, t_min, t_max, left_rec);
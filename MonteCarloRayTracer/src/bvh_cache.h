@@ -0,0 +1,441 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "material_table.h"
+#include "sbvh.h"
+#include "stats.h"
+
+// binary cache of a compressed mesh bvh. the file is mapped read only and
+// traversed in place: a header followed by the qbvh nodes, the leaf references,
+// the corner positions as 9 float arrays (p0.xyz, p1.xyz, p2.xyz), the corner
+// normals as 3 arrays and the uvs as 6 arrays (u0, v0, u1, v1, u2, v2) in the
+// packed encodings of vertex.h, a material index per triangle and the material
+// records, every section starting on a 16 byte boundary. the encodings are
+// recorded in attributes, a build with others does not map the file.
+const char bvh_cache_magic[8] = { 'M', 'C', 'R', 'T', 'B', 'V', 'H', 0 };
+const uint32_t bvh_cache_version = 4;
+const uint32_t bvh_cache_attributes = (RENDER_COMPACT_NORMALS ? 1 : 0) | (RENDER_HALF_UVS ? 2 : 0);
+const int bvh_cache_path_size = 256;
+
+struct bvh_cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t node_count;
+	uint64_t key;
+	uint32_t triangle_count;
+	uint32_t reference_count;
+	uint64_t node_offset;
+	uint64_t reference_offset;
+	uint64_t triangle_offset;
+	uint64_t normal_offset;
+	uint64_t uv_offset;
+	uint64_t material_index_offset;
+	uint32_t material_count;
+	uint32_t attributes;	// bit 0 octahedral normals, bit 1 half uvs
+	uint64_t material_offset;
+	uint64_t file_size;
+	float lo[3], hi[3];	// bounds of the mesh
+};
+
+struct bvh_cache_material {
+	float ka[3], kd[3], ks[3];
+	float shininess, refracti, opacity;
+	int32_t type;
+	char diffuse_map[bvh_cache_path_size];	// zero terminated, empty if untextured
+	char specular_map[bvh_cache_path_size];
+};
+
+class mapped_mesh : public hittable {
+public:
+	mapped_mesh(void* base, size_t size, const material_table& materials);
+	~mapped_mesh();
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+	virtual bool bounding_box(float t0, float t1, aabb& box) const override;
+
+private:
+	vec3 vertex(int corner, int index) const;
+	vec3 normal(int corner, int index) const;
+	float texcoord(int attribute, int index) const;
+
+	void* base;
+	size_t size;
+	aabb bounds;
+	const qbvh_node* nodes;
+	const int32_t* refs;
+	const float* positions;
+	const packed_normal* normals;
+	const packed_uv* uvs;
+	const int32_t* material_index;
+	int triangle_count;
+	material_table materials;
+};
+
+// cache key
+// ---------
+// fnv-1a over a file, collecting the mtllib lines of an obj on the way
+inline bool bvh_cache_hash_file(const std::string& path, uint64_t& hash, std::vector<std::string>* libraries) {
+	std::ifstream in(path, std::ios::binary);
+	if (!in)
+		return false;
+	char buffer[1 << 16];
+	std::string line;
+	bool collecting = true;
+	while (in) {
+		in.read(buffer, sizeof(buffer));
+		std::streamsize n = in.gcount();
+		for (std::streamsize i = 0; i < n; i++) {
+			hash ^= (unsigned char)buffer[i];
+			hash *= 1099511628211ull;
+			if (!libraries)
+				continue;
+			if (buffer[i] == '\n' || buffer[i] == '\r') {
+				if (line.size() > 7)
+					libraries->push_back(line.substr(7));
+				line.clear();
+				collecting = true;
+			}
+			else if (collecting) {
+				line += buffer[i];
+				collecting = line.size() > 7 || memcmp(line.data(), "mtllib ", line.size()) == 0;
+				if (!collecting)
+					line.clear();
+			}
+		}
+	}
+	if (libraries && line.size() > 7)
+		libraries->push_back(line.substr(7));
+	return true;
+}
+
+// covers the source file and the material libraries it names, so an edited
+// mesh or material never maps a stale tree
+inline unsigned long long bvh_cache_key(const std::string& path, bool spatial_splits) {
+	uint64_t hash = 14695981039346656037ull;
+	std::vector<std::string> libraries;
+	if (!bvh_cache_hash_file(path, hash, &libraries))
+		return 0;
+	std::string directory = path.substr(0, path.find_last_of('/') + 1);
+	for (size_t i = 0; i < libraries.size(); i++)
+		bvh_cache_hash_file(directory + libraries[i], hash, 0);
+	hash ^= bvh_cache_version;
+	hash *= 1099511628211ull;
+	hash ^= bvh_cache_attributes;
+	hash *= 1099511628211ull;
+	hash ^= spatial_splits ? 1 : 0;
+	hash *= 1099511628211ull;
+	return hash;
+}
+
+// trees with and without spatial splits of one model are cached side by side
+inline std::string bvh_cache_path(const std::string& path, bool spatial_splits) {
+	return path + (spatial_splits ? ".sbvh.bvh" : ".bvh");
+}
+
+inline uint64_t bvh_cache_align(uint64_t offset) {
+	return (offset + 15) & ~uint64_t(15);
+}
+
+// write
+// -----
+// material_of holds the index into materials of every triangle, the tree
+// has to be compressed. the file is written under a name of its own and then
+// renamed over the old one, which other processes may still have mapped:
+// their mappings keep the old contents, and no reader sees half a file.
+bool write_bvh_cache(const std::string& path, unsigned long long key, const sbvh& tree, Triangle** l, int n,
+	const int* material_of, const std::vector<material_description>& materials) {
+	if (!tree.compressed())
+		return false;
+	std::unordered_map<const Triangle*, int32_t> index;
+	for (int i = 0; i < n; i++)
+		index[l[i]] = i;
+
+	bvh_cache_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, bvh_cache_magic, sizeof(header.magic));
+	header.version = bvh_cache_version;
+	header.attributes = bvh_cache_attributes;
+	header.key = key;
+	header.node_count = uint32_t(tree.wide.size());
+	header.reference_count = uint32_t(tree.refs.size());
+	header.triangle_count = uint32_t(n);
+	header.node_offset = bvh_cache_align(sizeof(header));
+	header.reference_offset = bvh_cache_align(header.node_offset + header.node_count * sizeof(qbvh_node));
+	header.triangle_offset = bvh_cache_align(header.reference_offset + header.reference_count * sizeof(int32_t));
+	header.normal_offset = bvh_cache_align(header.triangle_offset + uint64_t(9) * n * sizeof(float));
+	header.uv_offset = bvh_cache_align(header.normal_offset + uint64_t(3) * n * sizeof(packed_normal));
+	header.material_index_offset = bvh_cache_align(header.uv_offset + uint64_t(6) * n * sizeof(packed_uv));
+	header.material_count = uint32_t(materials.size());
+	header.material_offset = bvh_cache_align(header.material_index_offset + uint64_t(n) * sizeof(int32_t));
+	header.file_size = header.material_offset + header.material_count * sizeof(bvh_cache_material);
+	for (int a = 0; a < 3; a++) {
+		header.lo[a] = tree.bounds.min()[a];
+		header.hi[a] = tree.bounds.max()[a];
+	}
+
+	std::vector<char> data(size_t(header.file_size), 0);
+	memcpy(&data[0], &header, sizeof(header));
+	memcpy(&data[size_t(header.node_offset)], tree.wide.data(), tree.wide.size() * sizeof(qbvh_node));
+	int32_t* refs = (int32_t*)&data[size_t(header.reference_offset)];
+	for (size_t i = 0; i < tree.refs.size(); i++)
+		refs[i] = index[tree.refs[i]];
+	// the attributes are copied as the triangles packed them
+	float* positions = (float*)&data[size_t(header.triangle_offset)];
+	packed_normal* normals = (packed_normal*)&data[size_t(header.normal_offset)];
+	packed_uv* uvs = (packed_uv*)&data[size_t(header.uv_offset)];
+	for (int i = 0; i < n; i++) {
+		const vec3* corners[3] = { &l[i]->v0, &l[i]->v1, &l[i]->v2 };
+		for (int k = 0; k < 3; k++) {
+			for (int c = 0; c < 3; c++)
+				positions[(3 * k + c) * n + i] = (*corners[k])[c];
+			normals[k * n + i] = l[i]->n[k];
+			uvs[(2 * k) * n + i] = l[i]->uv[k][0];
+			uvs[(2 * k + 1) * n + i] = l[i]->uv[k][1];
+		}
+	}
+	int32_t* material_index = (int32_t*)&data[size_t(header.material_index_offset)];
+	for (int i = 0; i < n; i++)
+		material_index[i] = material_of[i];
+	bvh_cache_material* records = (bvh_cache_material*)&data[size_t(header.material_offset)];
+	for (size_t i = 0; i < materials.size(); i++) {
+		const material_description& m = materials[i];
+		if (m.diffuse_map.size() >= bvh_cache_path_size || m.specular_map.size() >= bvh_cache_path_size)
+			return false;
+		for (int c = 0; c < 3; c++) {
+			records[i].ka[c] = m.ka[c];
+			records[i].kd[c] = m.kd[c];
+			records[i].ks[c] = m.ks[c];
+		}
+		records[i].shininess = m.shininess;
+		records[i].refracti = m.refracti;
+		records[i].opacity = m.opacity;
+		records[i].type = int32_t(m.type);
+		memcpy(records[i].diffuse_map, m.diffuse_map.c_str(), m.diffuse_map.size());
+		memcpy(records[i].specular_map, m.specular_map.c_str(), m.specular_map.size());
+	}
+
+	std::ostringstream unique;
+#ifdef _WIN32
+	unique << path << ".tmp" << _getpid() << "." << std::hash<std::thread::id>()(std::this_thread::get_id());
+#else
+	unique << path << ".tmp" << getpid() << "." << std::hash<std::thread::id>()(std::this_thread::get_id());
+#endif
+	std::string temporary = unique.str();
+	{
+		std::ofstream out(temporary, std::ios::binary);
+		out.write(&data[0], data.size());
+		if (!out) {
+			out.close();
+			remove(temporary.c_str());
+			return false;
+		}
+	}
+#ifdef _WIN32
+	// windows refuses to replace a file that is mapped, the tree then stays in memory
+	bool renamed = MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	bool renamed = rename(temporary.c_str(), path.c_str()) == 0;
+#endif
+	if (!renamed)
+		remove(temporary.c_str());
+	return renamed;
+}
+
+// load
+// ----
+// the materials come from the cached records, or all become mat if it is set
+mapped_mesh* load_bvh_cache(const std::string& path, unsigned long long key, material* mat, texture_library& textures, arena& memory) {
+	void* base = 0;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (file == INVALID_HANDLE_VALUE)
+		return 0;
+	LARGE_INTEGER file_size;
+	if (GetFileSizeEx(file, &file_size) && file_size.QuadPart >= LONGLONG(sizeof(bvh_cache_header))) {
+		HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+		if (mapping) {
+			base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			size = size_t(file_size.QuadPart);
+			CloseHandle(mapping);
+		}
+	}
+	CloseHandle(file);
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return 0;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size >= off_t(sizeof(bvh_cache_header))) {
+		base = mmap(0, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (base == MAP_FAILED)
+			base = 0;
+		size = size_t(st.st_size);
+	}
+	close(fd);
+#endif
+	if (!base)
+		return 0;
+
+	const bvh_cache_header* header = (const bvh_cache_header*)base;
+	bool valid = memcmp(header->magic, bvh_cache_magic, sizeof(header->magic)) == 0
+		&& header->version == bvh_cache_version
+		&& header->attributes == bvh_cache_attributes
+		&& header->key == key
+		&& header->file_size == size
+		&& header->node_count > 0
+		&& header->node_offset + uint64_t(header->node_count) * sizeof(qbvh_node) <= header->reference_offset
+		&& header->reference_offset + uint64_t(header->reference_count) * sizeof(int32_t) <= header->triangle_offset
+		&& header->triangle_offset + uint64_t(9) * header->triangle_count * sizeof(float) <= header->normal_offset
+		&& header->normal_offset + uint64_t(3) * header->triangle_count * sizeof(packed_normal) <= header->uv_offset
+		&& header->uv_offset + uint64_t(6) * header->triangle_count * sizeof(packed_uv) <= header->material_index_offset
+		&& header->material_index_offset + uint64_t(header->triangle_count) * sizeof(int32_t) <= header->material_offset
+		&& header->material_offset + uint64_t(header->material_count) * sizeof(bvh_cache_material) <= size;
+	const int32_t* material_index = valid ? (const int32_t*)((const char*)base + header->material_index_offset) : 0;
+	for (uint32_t i = 0; valid && i < header->triangle_count; i++)
+		valid = material_index[i] >= 0 && uint32_t(material_index[i]) < header->material_count;
+	const int32_t* refs = valid ? (const int32_t*)((const char*)base + header->reference_offset) : 0;
+	for (uint32_t i = 0; valid && i < header->reference_count; i++)
+		valid = refs[i] >= 0 && uint32_t(refs[i]) < header->triangle_count;
+	// children inside the file, nodes only ever point forward, and no deeper
+	// than the traversal stack is sized for
+	const qbvh_node* nodes = valid ? (const qbvh_node*)((const char*)base + header->node_offset) : 0;
+	std::vector<int> depth(valid ? header->node_count : 0, 0);
+	if (valid)
+		depth[0] = 1;
+	for (uint32_t i = 0; valid && i < header->node_count; i++) {
+		valid = nodes[i].used >= 1 && nodes[i].used <= qbvh_width;
+		for (int k = 0; valid && k < nodes[i].used; k++) {
+			int32_t child = nodes[i].child[k];
+			valid = nodes[i].count[k] > 0 ? child >= 0 && uint64_t(child) + nodes[i].count[k] <= header->reference_count
+				: child > int32_t(i) && uint32_t(child) < header->node_count;
+			if (valid && nodes[i].count[k] == 0) {
+				depth[child] = std::max(depth[child], depth[i] + 1);
+				valid = depth[child] <= qbvh_max_depth;
+			}
+		}
+	}
+	if (!valid) {
+#ifdef _WIN32
+		UnmapViewOfFile(base);
+#else
+		munmap(base, size);
+#endif
+		return 0;
+	}
+	const bvh_cache_material* records = (const bvh_cache_material*)((const char*)base + header->material_offset);
+	material_table materials(header->material_count, mat);
+	for (uint32_t i = 0; !mat && i < header->material_count; i++) {
+		material_description m;
+		m.ka = vec3(records[i].ka[0], records[i].ka[1], records[i].ka[2]);
+		m.kd = vec3(records[i].kd[0], records[i].kd[1], records[i].kd[2]);
+		m.ks = vec3(records[i].ks[0], records[i].ks[1], records[i].ks[2]);
+		m.shininess = records[i].shininess;
+		m.refracti = records[i].refracti;
+		m.opacity = records[i].opacity;
+		m.type = MATERIAL_TYPE(records[i].type);
+		m.diffuse_map.assign(records[i].diffuse_map, strnlen(records[i].diffuse_map, bvh_cache_path_size));
+		m.specular_map.assign(records[i].specular_map, strnlen(records[i].specular_map, bvh_cache_path_size));
+		materials[i] = make_material(m, textures, memory);
+	}
+	return memory.make<mapped_mesh>(base, size, materials);
+}
+
+// mapped mesh
+// -----------
+mapped_mesh::mapped_mesh(void* base, size_t size, const material_table& materials) : base(base), size(size), materials(materials) {
+	const bvh_cache_header* header = (const bvh_cache_header*)base;
+	const char* bytes = (const char*)base;
+	bounds = aabb(vec3(header->lo[0], header->lo[1], header->lo[2]), vec3(header->hi[0], header->hi[1], header->hi[2]));
+	nodes = (const qbvh_node*)(bytes + header->node_offset);
+	refs = (const int32_t*)(bytes + header->reference_offset);
+	positions = (const float*)(bytes + header->triangle_offset);
+	normals = (const packed_normal*)(bytes + header->normal_offset);
+	uvs = (const packed_uv*)(bytes + header->uv_offset);
+	material_index = (const int32_t*)(bytes + header->material_index_offset);
+	triangle_count = int(header->triangle_count);
+}
+
+mapped_mesh::~mapped_mesh() {
+#ifdef _WIN32
+	UnmapViewOfFile(base);
+#else
+	munmap(base, size);
+#endif
+}
+
+inline vec3 mapped_mesh::vertex(int corner, int index) const {
+	const float* a = positions + 3 * corner * triangle_count;
+	return vec3(a[index], a[triangle_count + index], a[2 * triangle_count + index]);
+}
+
+inline vec3 mapped_mesh::normal(int corner, int index) const {
+	return unpack_normal(normals[corner * triangle_count + index]);
+}
+
+// 0 to 5 for u0, v0, u1, v1, u2, v2
+inline float mapped_mesh::texcoord(int attribute, int index) const {
+	return unpack_uv(uvs[attribute * triangle_count + index]);
+}
+
+bool mapped_mesh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+	int closest = -1;
+	float closest_t = t_max, closest_u = 0, closest_v = 0;
+	bool hit_anything = qbvh_hit(nodes, r, t_min, t_max, [&](int first, int count, float t_min, float& t_max) {
+		bool hit_leaf = false;
+		for (int i = first; i < first + count; i++) {
+			float t, u, v;
+			if (intersect_triangle(r, vertex(0, refs[i]), vertex(1, refs[i]), vertex(2, refs[i]), t_min, t_max, t, u, v)) {
+				hit_leaf = true;
+				t_max = closest_t = t;
+				closest = refs[i];
+				closest_u = u;
+				closest_v = v;
+			}
+		}
+		return hit_leaf;
+	});
+	if (!hit_anything)
+		return false;
+
+	// shade only the closest triangle
+	float u = closest_u, v = closest_v, w = 1.0f - u - v;
+	float uv[3][2];
+	for (int k = 0; k < 3; k++) {
+		uv[k][0] = texcoord(2 * k, closest);
+		uv[k][1] = texcoord(2 * k + 1, closest);
+	}
+	rec.u = w * uv[0][0] + u * uv[1][0] + v * uv[2][0];
+	rec.v = w * uv[0][1] + u * uv[1][1] + v * uv[2][1];
+	rec.uv_scale = triangle_uv_scale(vertex(0, closest), vertex(1, closest), vertex(2, closest), uv);
+	rec.t = closest_t;
+	rec.p = r.point_at_parameter(closest_t);
+	rec.mat_ptr = materials[material_index[closest]];
+	rec.normal = unit_vector(w * normal(0, closest) + u * normal(1, closest) + v * normal(2, closest));
+	return true;
+}
+
+bool mapped_mesh::bounding_box(float t0, float t1, aabb& box) const {
+	box = bounds;
+	return true;
+}
\ No newline at end of file
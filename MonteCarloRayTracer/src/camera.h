@@ -6,6 +6,7 @@ class camera {
 public:
 	camera(vec3 lookfrom, vec3 lookat, vec3 vup, float vfov, float aspect, float aperture, float focus_dist, float t0, float t1);
 	ray get_ray(float s, float t);
+	void set_image_height(int ny);	// primary rays get a cone one pixel wide
 
 private:
 	vec3 origin;
@@ -15,12 +16,16 @@ private:
 	vec3 u, v, w;
 	float time0, time1;
 	float lens_radius;
+	float focus;
+	float pixel_spread;
 };
 
 camera::camera(vec3 lookfrom, vec3 lookat, vec3 vup, float vfov, float aspect, float aperture, float focus_dist, float t0, float t1) {
 	time0 = t0;
 	time1 = t1;
 	lens_radius = aperture / 2;
+	focus = focus_dist;
+	pixel_spread = 0;
 	float theta = vfov * M_PI / 180;
 	float half_height = tan(theta / 2);
 	float half_width = aspect * half_height;
@@ -37,5 +42,11 @@ ray camera::get_ray(float s, float t) {
 	vec3 rd = lens_radius * random_in_unit_disk();
 	vec3 offset = u * rd.x() + v * rd.y();
 	float time = time0 + random_double() * (time1 - time0);
-	return ray(origin + offset, lower_left_corner + s * horizontal + t * vertical - origin - offset, time);
+	ray r(origin + offset, lower_left_corner + s * horizontal + t * vertical - origin - offset, time);
+	r.set_cone(0, pixel_spread);
+	return r;
+}
+
+void camera::set_image_height(int ny) {
+	pixel_spread = vertical.length() / (focus * ny);
 }
\ No newline at end of file
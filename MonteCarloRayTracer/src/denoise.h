@@ -0,0 +1,233 @@
+#pragma once
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "aov.h"
+#include "framebuffer.h"
+#include "vec3.h"
+
+// denoiser for the beauty pass, guided by the first hit aovs, after rousselle,
+// knaus and zwicker's feature and color filter. every pixel becomes a weighted
+// mean of the pixels within radius of it. the weight of a neighbour is the
+// smaller of two. the color weight is non-local means: the patches around
+// both pixels are compared relative to the noise the framebuffer measured in
+// them, which keeps shadows and caustics the aovs cannot see. the feature
+// weight compares albedo, normal and depth relative to their own noise and
+// gradients, which keeps texture and geometry edges that noisy colors would
+// blur. noise that both estimate the same value is subtracted from every
+// difference, so flat regions average freely.
+//
+// the result is biased, it trades the noise for a little blur. the benchmark
+// reports at how many samples the plain render reaches the same error.
+struct denoise_settings {
+	denoise_settings() : radius(10), patch(1), k_color(1.0f), k_feature(1.0f), tau(1e-3f), threads(1) {}
+
+	int radius;	// neighbourhood of 2 * radius + 1 pixels square
+	int patch;	// color patches of 2 * patch + 1 pixels square
+	float k_color;	// larger averages more, in standard errors of the color difference
+	float k_feature;	// the same for the aovs
+	float tau;	// smallest feature variance, so clean features still allow some slope
+	int threads;
+};
+
+std::vector<vec3> denoise(const framebuffer& image, const aov_buffer& aovs, const denoise_settings& settings);
+
+// denoise
+// -------
+const int denoise_band = 16;	// rows a thread filters at a time
+const int denoise_groups = 3;	// albedo, normal and depth, each compared as a whole
+const int denoise_group_start[denoise_groups + 1] = { aov_buffer::albedo_r, aov_buffer::normal_x, aov_buffer::depth, aov_buffer::channel_count };
+
+// the means of a pixel and their variances, as planes of floats so the
+// distance loops run over contiguous rows
+struct denoise_planes {
+	std::vector<float> color[3], color_variance[3];
+	std::vector<float> feature[aov_buffer::channel_count], feature_variance[aov_buffer::channel_count];
+	std::vector<float> feature_scale[denoise_groups];	// 1 / (k_feature^2 max(tau, variance, gradient^2))
+};
+
+inline int denoise_clamp(int v, int hi) {
+	return std::min(std::max(v, 0), hi);
+}
+
+// color distance of pixels p and q, in standard errors of their difference
+// and less the part the noise explains, averaged over the channels
+inline float denoise_color_distance(const denoise_planes& planes, float k2, int p, int q) {
+	float d = 0;
+	for (int k = 0; k < 3; k++) {
+		float vp = planes.color_variance[k][p], vq = planes.color_variance[k][q];
+		float difference = planes.color[k][p] - planes.color[k][q];
+		d += (difference * difference - (vp + std::min(vp, vq))) / (1e-10f + k2 * (vp + vq));
+	}
+	return d * (1.0f / 3);
+}
+
+// the largest feature distance of the three groups
+inline float denoise_feature_distance(const denoise_planes& planes, int p, int q) {
+	float d = 0;
+	for (int g = 0; g < denoise_groups; g++) {
+		float group = 0;
+		for (int c = denoise_group_start[g]; c < denoise_group_start[g + 1]; c++) {
+			float vp = planes.feature_variance[c][p], vq = planes.feature_variance[c][q];
+			float difference = planes.feature[c][p] - planes.feature[c][q];
+			group += difference * difference - (vp + std::min(vp, vq));
+		}
+		d = std::max(d, group * planes.feature_scale[g][p]);
+	}
+	return d;
+}
+
+denoise_planes make_denoise_planes(const framebuffer& image, const aov_buffer& aovs, const denoise_settings& settings) {
+	int nx = image.nx, ny = image.ny, n = nx * ny;
+	float samples = float(std::max(1, image.sample_count()));
+	float aov_samples = float(std::max(1, aovs.sample_count()));
+	denoise_planes planes;
+	for (int k = 0; k < 3; k++) {
+		planes.color[k].resize(n);
+		planes.color_variance[k].resize(n);
+	}
+	for (int y = 0; y < ny; y++) {
+		for (int x = 0; x < nx; x++) {
+			vec3 m = image.mean(x, y), v = image.variance(x, y);
+			for (int k = 0; k < 3; k++) {
+				planes.color[k][y * nx + x] = m[k];
+				planes.color_variance[k][y * nx + x] = v[k] / samples;
+			}
+		}
+	}
+	// depth in units of the farthest hit, so tau means the same in every scene
+	float farthest = 0;
+	for (int i = 0; i < n; i++)
+		farthest = std::max(farthest, aovs.mean(aov_buffer::depth, i));
+	for (int c = 0; c < aov_buffer::channel_count; c++) {
+		float scale = c == aov_buffer::depth && farthest > 0 ? 1 / farthest : 1.0f;
+		planes.feature[c].resize(n);
+		planes.feature_variance[c].resize(n);
+		for (int i = 0; i < n; i++) {
+			planes.feature[c][i] = aovs.mean(c, i) * scale;
+			planes.feature_variance[c][i] = aovs.variance(c, i) * scale * scale / aov_samples;
+		}
+	}
+	// a feature that slopes across the pixel, like the normals of a sphere,
+	// allows differences of the size of its slope
+	float k2 = settings.k_feature * settings.k_feature;
+	for (int g = 0; g < denoise_groups; g++) {
+		planes.feature_scale[g].resize(n);
+		for (int y = 0; y < ny; y++) {
+			for (int x = 0; x < nx; x++) {
+				int left = y * nx + std::max(x - 1, 0), right = y * nx + std::min(x + 1, nx - 1);
+				int up = std::max(y - 1, 0) * nx + x, down = std::min(y + 1, ny - 1) * nx + x;
+				float variance = 0, gradient = 0;
+				for (int c = denoise_group_start[g]; c < denoise_group_start[g + 1]; c++) {
+					const std::vector<float>& f = planes.feature[c];
+					float gx = 0.5f * (f[right] - f[left]), gy = 0.5f * (f[down] - f[up]);
+					variance += planes.feature_variance[c][y * nx + x];
+					gradient += gx * gx + gy * gy;
+				}
+				planes.feature_scale[g][y * nx + x] = 1 / (k2 * std::max(settings.tau, std::max(variance, gradient)));
+			}
+		}
+	}
+	return planes;
+}
+
+// threads take bands of rows. for every offset to a neighbour a band computes
+// the color distances of its pixels and a margin of patch rows, sums them
+// over the patches with running box sums and weighs the neighbours, so a
+// patch costs the same whatever its size. rows of pixels whose neighbour and
+// patch stay inside the image are contiguous in all planes.
+std::vector<vec3> denoise(const framebuffer& image, const aov_buffer& aovs, const denoise_settings& settings) {
+	int nx = image.nx, ny = image.ny;
+	denoise_planes planes = make_denoise_planes(image, aovs, settings);
+	std::vector<vec3> result(nx * ny);
+	int bands = (ny + denoise_band - 1) / denoise_band;
+	std::atomic<int> next(0);
+	auto work = [&]() {
+		int r = settings.radius, f = settings.patch;
+		int width = nx + 2 * f;
+		float k2 = settings.k_color * settings.k_color;
+		float patch_area = float((2 * f + 1) * (2 * f + 1));
+		std::vector<float> distance, horizontal, column(nx), weight_sum, sums[3];
+		for (int band = next++; band < bands; band = next++) {
+			int y0 = band * denoise_band;
+			int rows = std::min(y0 + denoise_band, ny) - y0;
+			distance.resize((rows + 2 * f) * width);
+			horizontal.resize((rows + 2 * f) * nx);
+			weight_sum.assign(rows * nx, 0.0f);
+			for (int k = 0; k < 3; k++)
+				sums[k].assign(rows * nx, 0.0f);
+			for (int dy = -r; dy <= r; dy++) {
+				for (int dx = -r; dx <= r; dx++) {
+					// pixel by pixel distances, clamped to the image at the borders
+					for (int j = 0; j < rows + 2 * f; j++) {
+						int y = denoise_clamp(y0 - f + j, ny - 1);
+						int yq = denoise_clamp(y + dy, ny - 1);
+						float* d = &distance[j * width];
+						int xa = std::max(0, -dx), xb = std::max(xa, std::min(nx, nx - dx));
+						auto clamped = [&](int i) {
+							int x = denoise_clamp(i - f, nx - 1);
+							return denoise_color_distance(planes, k2, y * nx + x, yq * nx + denoise_clamp(x + dx, nx - 1));
+						};
+						for (int i = 0; i < std::min(xa + f, width); i++)
+							d[i] = clamped(i);
+						for (int x = xa; x < xb; x++)
+							d[x + f] = denoise_color_distance(planes, k2, y * nx + x, yq * nx + x + dx);
+						for (int i = xb + f; i < width; i++)
+							d[i] = clamped(i);
+					}
+					// patch sums, first along the rows, then down the columns
+					for (int j = 0; j < rows + 2 * f; j++) {
+						const float* d = &distance[j * width];
+						float* h = &horizontal[j * nx];
+						float running = 0;
+						for (int i = 0; i < 2 * f; i++)
+							running += d[i];
+						for (int x = 0; x < nx; x++) {
+							running += d[x + 2 * f];
+							h[x] = running;
+							running -= d[x];
+						}
+					}
+					std::fill(column.begin(), column.end(), 0.0f);
+					for (int j = 0; j < 2 * f; j++) {
+						for (int x = 0; x < nx; x++)
+							column[x] += horizontal[j * nx + x];
+					}
+					for (int j = 0; j < rows; j++) {
+						int y = y0 + j;
+						for (int x = 0; x < nx; x++)
+							column[x] += horizontal[(j + 2 * f) * nx + x];
+						if (y + dy >= 0 && y + dy < ny) {
+							int xa = std::max(0, -dx), xb = std::min(nx, nx - dx);
+							for (int x = xa; x < xb; x++) {
+								int p = y * nx + x, q = p + dy * nx + dx;
+								float color_distance = std::max(0.0f, column[x] / patch_area);
+								float weight = expf(-std::max(color_distance, denoise_feature_distance(planes, p, q)));
+								weight_sum[j * nx + x] += weight;
+								for (int k = 0; k < 3; k++)
+									sums[k][j * nx + x] += weight * planes.color[k][q];
+							}
+						}
+						for (int x = 0; x < nx; x++)
+							column[x] -= horizontal[j * nx + x];
+					}
+				}
+			}
+			for (int j = 0; j < rows; j++) {
+				for (int x = 0; x < nx; x++) {
+					float w = weight_sum[j * nx + x];
+					result[(y0 + j) * nx + x] = vec3(sums[0][j * nx + x], sums[1][j * nx + x], sums[2][j * nx + x]) / w;
+				}
+			}
+		}
+	};
+	std::vector<std::thread> workers;
+	for (int t = 1; t < settings.threads; t++)
+		workers.push_back(std::thread(work));
+	work();
+	for (size_t t = 0; t < workers.size(); t++)
+		workers[t].join();
+	return result;
+}
\ No newline at end of file
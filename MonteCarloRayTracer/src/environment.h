@@ -0,0 +1,110 @@
+#pragma once
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "alias_table.h"
+#include "hittable.h"
+#include "pdf.h"
+#include "random.h"
+#include "stb_image.h"
+
+// light from infinitely far away, stored as a latitude-longitude HDR image
+// with +y up. directions are importance sampled in proportion to luminance
+// times sin(theta): an alias table picks the row and a per row table picks
+// the column, so a sample costs four random numbers and no searching.
+class environment_map {
+public:
+	environment_map(const float* rgb, int width, int height, float intensity = 1.0f);
+	static environment_map* load(const std::string& path, float intensity = 1.0f);
+	vec3 value(const vec3& direction) const;
+	vec3 sample(float& pdf) const;
+	float pdf_value(const vec3& direction) const;
+
+private:
+	void pixel(const vec3& direction, int& x, int& y) const;
+
+	std::vector<vec3> texels;
+	alias_table rows;
+	std::vector<alias_table> columns;
+	int nx, ny;
+};
+
+class environment_pdf : public pdf {
+public:
+	environment_pdf(const environment_map* e) : environment(e) {}
+	virtual float value(const vec3& direction) const override { return environment->pdf_value(direction); }
+	virtual vec3 generate() const override { float pdf; return environment->sample(pdf); }
+
+private:
+	const environment_map* environment;
+};
+
+// environment map
+// ---------------
+environment_map::environment_map(const float* rgb, int width, int height, float intensity) : texels(width * height), nx(width), ny(height) {
+	std::vector<float> weights(nx);
+	std::vector<float> row_weights(ny);
+	columns.reserve(ny);
+	for (int y = 0; y < ny; y++) {
+		float sin_theta = sin(M_PI * (y + 0.5f) / ny);
+		for (int x = 0; x < nx; x++) {
+			const float* p = rgb + 3 * (y * nx + x);
+			vec3 c = intensity * vec3(p[0], p[1], p[2]);
+			texels[y * nx + x] = c;
+			weights[x] = (0.2126f * c.r() + 0.7152f * c.g() + 0.0722f * c.b()) * sin_theta;
+		}
+		columns.push_back(alias_table(weights.data(), nx));
+		row_weights[y] = columns.back().total();
+	}
+	rows = alias_table(row_weights.data(), ny);
+}
+
+// returns 0 if the image cannot be read
+environment_map* environment_map::load(const std::string& path, float intensity) {
+	int width, height, channels;
+	float* rgb = stbi_loadf(path.c_str(), &width, &height, &channels, 3);
+	if (!rgb) {
+		std::cerr << "cannot load environment map " << path << std::endl;
+		return 0;
+	}
+	environment_map* e = new environment_map(rgb, width, height, intensity);
+	stbi_image_free(rgb);
+	return e;
+}
+
+inline void environment_map::pixel(const vec3& direction, int& x, int& y) const {
+	float theta = acos(ffmax(-1.0f, ffmin(1.0f, direction.y())));
+	float phi = atan2(direction.z(), direction.x());
+	if (phi < 0)
+		phi += 2 * M_PI;
+	x = std::min(int(phi * (0.5f / M_PI) * nx), nx - 1);
+	y = std::min(int(theta * (1.0f / M_PI) * ny), ny - 1);
+}
+
+vec3 environment_map::value(const vec3& direction) const {
+	int x, y;
+	pixel(direction, x, y);
+	return texels[y * nx + x];
+}
+
+// uniform inside the chosen pixel, so the solid angle density is the pixel
+// probability over the pixel's area on the sphere
+vec3 environment_map::sample(float& pdf) const {
+	float row_pdf, column_pdf;
+	int y = rows.sample(random_double(), row_pdf);
+	int x = columns[y].sample(random_double(), column_pdf);
+	float theta = M_PI * (y + random_double()) / ny;
+	float phi = 2 * M_PI * (x + random_double()) / nx;
+	float sin_theta = sin(theta);
+	pdf = sin_theta > 0 ? row_pdf * column_pdf * nx * ny / (2 * M_PI * M_PI * sin_theta) : 0;
+	return vec3(sin_theta * cos(phi), cos(theta), sin_theta * sin(phi));
+}
+
+float environment_map::pdf_value(const vec3& direction) const {
+	int x, y;
+	pixel(direction, x, y);
+	float sin_theta = sqrt(ffmax(0.0f, 1 - direction.y() * direction.y()));
+	if (sin_theta <= 0)
+		return 0;
+	return rows.pdf(y) * columns[y].pdf(x) * nx * ny / (2 * M_PI * M_PI * sin_theta);
+}
\ No newline at end of file
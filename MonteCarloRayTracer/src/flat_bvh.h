@@ -0,0 +1,116 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+#include "hittable.h"
+
+// binned SAH build over a list of boxes into a depth first node array. the
+// left child of an inner node follows it, primitives are referenced through
+// order so callers can reorder their own data to match the leaves.
+const int flat_bvh_bins = 16;
+const int flat_bvh_max_leaf = 2;
+const int flat_bvh_sah_depth = 64;
+const int flat_bvh_stack_size = 128;
+
+struct flat_bvh_node {
+	aabb box;
+	int offset;	// first primitive of a leaf, right child of an inner node
+	int count;	// number of primitives, 0 for inner nodes
+	int axis;
+};
+
+int flat_bvh_build(const std::vector<aabb>& boxes, const std::vector<vec3>& centroids, std::vector<int>& order, int begin, int end, int depth, std::vector<flat_bvh_node>& nodes) {
+	int index = int(nodes.size());
+	nodes.push_back(flat_bvh_node());
+	int n = end - begin;
+	aabb box = boxes[order[begin]];
+	vec3 cmin = centroids[order[begin]], cmax = cmin;
+	for (int i = begin + 1; i < end; i++) {
+		box = surrounding_box(box, boxes[order[i]]);
+		for (int a = 0; a < 3; a++) {
+			cmin[a] = ffmin(cmin[a], centroids[order[i]][a]);
+			cmax[a] = ffmax(cmax[a], centroids[order[i]][a]);
+		}
+	}
+	nodes[index].box = padded_box(box.min(), box.max());
+	if (n <= flat_bvh_max_leaf) {
+		nodes[index].offset = begin;
+		nodes[index].count = n;
+		nodes[index].axis = 0;
+		return index;
+	}
+
+	int axis = aabb(cmin, cmax).longest_axis();
+	float extent = cmax[axis] - cmin[axis];
+	int mid = begin + n / 2;
+	if (extent > 0 && depth < flat_bvh_sah_depth) {
+		int counts[flat_bvh_bins] = { 0 };
+		aabb bounds[flat_bvh_bins];
+		float scale = flat_bvh_bins / extent;
+		for (int i = begin; i < end; i++) {
+			int b = std::min(int((centroids[order[i]][axis] - cmin[axis]) * scale), flat_bvh_bins - 1);
+			bounds[b] = counts[b] ? surrounding_box(bounds[b], boxes[order[i]]) : boxes[order[i]];
+			counts[b]++;
+		}
+		float right_area[flat_bvh_bins];
+		int right_count[flat_bvh_bins];
+		aabb right;
+		int count = 0;
+		for (int b = flat_bvh_bins - 1; b > 0; b--) {
+			if (counts[b])
+				right = count ? surrounding_box(right, bounds[b]) : bounds[b];
+			count += counts[b];
+			right_count[b] = count;
+			right_area[b] = count ? right.area() : 0;
+		}
+		aabb left;
+		count = 0;
+		float best = FLT_MAX;
+		int split = -1;
+		for (int b = 1; b < flat_bvh_bins; b++) {
+			if (counts[b - 1])
+				left = count ? surrounding_box(left, bounds[b - 1]) : bounds[b - 1];
+			count += counts[b - 1];
+			if (count == 0 || right_count[b] == 0)
+				continue;
+			float cost = left.area() * count + right_area[b] * right_count[b];
+			if (cost < best) {
+				best = cost;
+				split = b;
+			}
+		}
+		if (split > 0) {
+			int* p = std::partition(&order[0] + begin, &order[0] + end, [&](int i) {
+				return std::min(int((centroids[i][axis] - cmin[axis]) * scale), flat_bvh_bins - 1) < split;
+			});
+			mid = int(p - &order[0]);
+		}
+	}
+	if (mid == begin || mid == end || extent <= 0 || depth >= flat_bvh_sah_depth) {
+		mid = begin + n / 2;
+		std::nth_element(&order[0] + begin, &order[0] + mid, &order[0] + end, [&](int a, int b) {
+			return centroids[a][axis] < centroids[b][axis];
+		});
+	}
+
+	flat_bvh_build(boxes, centroids, order, begin, mid, depth + 1, nodes);
+	int right_child = flat_bvh_build(boxes, centroids, order, mid, end, depth + 1, nodes);
+	nodes[index].offset = right_child;
+	nodes[index].count = 0;
+	nodes[index].axis = axis;
+	return index;
+}
+
+void build_flat_bvh(const std::vector<aabb>& boxes, std::vector<flat_bvh_node>& nodes, std::vector<int>& order) {
+	int n = int(boxes.size());
+	nodes.clear();
+	order.resize(n);
+	if (n == 0)
+		return;
+	std::vector<vec3> centroids(n);
+	for (int i = 0; i < n; i++) {
+		order[i] = i;
+		centroids[i] = 0.5f * (boxes[i].min() + boxes[i].max());
+	}
+	nodes.reserve(2 * n);
+	flat_bvh_build(boxes, centroids, order, 0, n, 0, nodes);
+}
\ No newline at end of file
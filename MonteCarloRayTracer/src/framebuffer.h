@@ -0,0 +1,100 @@
+#pragma once
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "stb_image_write.h"
+#include "vec3.h"
+
+// running sum of radiance per pixel, row 0 at the top. passes add samples and
+// the image is written as their mean, so it can be saved after any pass. the
+// sum of squares gives every pixel's sample variance for reference tests.
+class framebuffer {
+public:
+	framebuffer(int width, int height) : nx(width), ny(height), sums(width * height, vec3(0, 0, 0)), squares(width * height, vec3(0, 0, 0)), samples(0) {}
+	void add(int x, int y, const vec3& c) {
+		sums[y * nx + x] += c;
+		squares[y * nx + x] += c * c;
+	}
+	void finish_pass(int n) { samples += n; }
+	int sample_count() const { return samples; }
+	vec3 mean(int x, int y) const { return samples > 0 ? sums[y * nx + x] / float(samples) : vec3(0, 0, 0); }
+	vec3 variance(int x, int y) const;
+	bool write(const std::string& path, const std::string& format) const;
+
+	const int nx, ny;
+
+private:
+	std::vector<vec3> sums;
+	std::vector<vec3> squares;
+	int samples;
+};
+
+bool write_image(const std::string& path, const std::string& format, const std::vector<vec3>& radiance, int nx, int ny);
+
+// the format of an output path, from its extension
+inline std::string image_format(const std::string& path) {
+	size_t dot = path.find_last_of('.');
+	std::string extension = dot == std::string::npos ? "" : path.substr(dot + 1);
+	for (size_t i = 0; i < extension.size(); i++)
+		extension[i] = char(tolower(extension[i]));
+	return extension;
+}
+
+inline bool image_format_supported(const std::string& format) {
+	return format == "ppm" || format == "png" || format == "bmp" || format == "tga" || format == "hdr";
+}
+
+// framebuffer
+// -----------
+// unbiased sample variance of one sample, per channel
+vec3 framebuffer::variance(int x, int y) const {
+	if (samples < 2)
+		return vec3(0, 0, 0);
+	vec3 m = mean(x, y);
+	vec3 v = (squares[y * nx + x] - float(samples) * m * m) / float(samples - 1);
+	return vec3(std::max(0.0f, v[0]), std::max(0.0f, v[1]), std::max(0.0f, v[2]));
+}
+
+bool framebuffer::write(const std::string& path, const std::string& format) const {
+	std::vector<vec3> pixels(nx * ny);
+	for (int y = 0; y < ny; y++) {
+		for (int x = 0; x < nx; x++)
+			pixels[y * nx + x] = mean(x, y);
+	}
+	return write_image(path, format, pixels, nx, ny);
+}
+
+// image
+// -----
+// radiance rows from the top. ppm, png, bmp and tga are gamma 2 like the
+// original ppm output, hdr keeps linear radiance
+bool write_image(const std::string& path, const std::string& format, const std::vector<vec3>& radiance, int nx, int ny) {
+	if (format == "hdr") {
+		std::vector<float> pixels(3 * nx * ny);
+		for (int i = 0; i < nx * ny; i++) {
+			for (int k = 0; k < 3; k++)
+				pixels[3 * i + k] = radiance[i][k];
+		}
+		return stbi_write_hdr(path.c_str(), nx, ny, 3, pixels.data()) != 0;
+	}
+	std::vector<unsigned char> pixels(3 * nx * ny);
+	for (int i = 0; i < nx * ny; i++) {
+		for (int k = 0; k < 3; k++)
+			pixels[3 * i + k] = (unsigned char)std::min(255.0f, 255.99f * sqrt(std::max(0.0f, radiance[i][k])));
+	}
+	if (format == "png")
+		return stbi_write_png(path.c_str(), nx, ny, 3, pixels.data(), 3 * nx) != 0;
+	if (format == "bmp")
+		return stbi_write_bmp(path.c_str(), nx, ny, 3, pixels.data()) != 0;
+	if (format == "tga")
+		return stbi_write_tga(path.c_str(), nx, ny, 3, pixels.data()) != 0;
+	if (format != "ppm")
+		return false;
+	std::ofstream os(path);
+	os << "P3\n" << nx << " " << ny << "\n255\n";
+	for (int i = 0; i < nx * ny; i++)
+		os << int(pixels[3 * i]) << " " << int(pixels[3 * i + 1]) << " " << int(pixels[3 * i + 2]) << "\n";
+	return bool(os);
+}
\ No newline at end of file
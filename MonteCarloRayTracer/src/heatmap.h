@@ -0,0 +1,110 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define HEATMAP_RDTSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HEATMAP_RDTSC 1
+#endif
+#include "stats.h"
+#include "stb_image_write.h"
+#include "vec3.h"
+
+// per pixel cost AOV: time and bvh nodes visited for every pixel, averaged
+// over the samples. time is in cpu cycles from rdtsc where available and in
+// nanoseconds elsewhere; node counts come from the stats counters and are
+// zero in RENDER_STATS=0 builds. each channel is written as a false color
+// png scaled to its 99th percentile and as a raw float pfm.
+class cost_buffer {
+public:
+	enum channel { time, steps, channel_count };
+
+	cost_buffer(int width, int height) : nx(width), ny(height), samples(0) {
+		for (int c = 0; c < channel_count; c++)
+			sums[c].assign(width * height, 0.0);
+	}
+	void add(int x, int y, uint64_t ticks, uint64_t nodes) {
+		sums[time][y * nx + x] += double(ticks);
+		sums[steps][y * nx + x] += double(nodes);
+	}
+	void finish_pass(int n) { samples += n; }
+	bool write(const std::string& base) const;
+
+	const int nx, ny;
+
+private:
+	std::vector<float> mean(channel c) const;
+
+	std::vector<double> sums[channel_count];
+	int samples;
+};
+
+inline uint64_t cost_clock() {
+#ifdef HEATMAP_RDTSC
+	return __rdtsc();
+#else
+	return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+inline uint64_t cost_steps() {
+	return local_stat(stat_bvh_nodes);
+}
+
+// black through purple, red and yellow to white, t in [0, 1]
+inline vec3 false_color(float t) {
+	const vec3 stops[5] = { vec3(0, 0, 0), vec3(0.35f, 0.05f, 0.55f), vec3(0.85f, 0.15f, 0.2f), vec3(1, 0.75f, 0.1f), vec3(1, 1, 1) };
+	t = std::min(std::max(t, 0.0f), 1.0f) * 4;
+	int i = std::min(int(t), 3);
+	float f = t - i;
+	return (1 - f) * stops[i] + f * stops[i + 1];
+}
+
+// single channel portable float map, rows bottom to top
+inline bool write_pfm(const std::string& path, const std::vector<float>& values, int nx, int ny) {
+	FILE* file = fopen(path.c_str(), "wb");
+	if (!file)
+		return false;
+	fprintf(file, "Pf\n%d %d\n-1.0\n", nx, ny);
+	for (int y = ny - 1; y >= 0; y--)
+		fwrite(&values[y * nx], sizeof(float), nx, file);
+	return fclose(file) == 0;
+}
+
+// cost buffer
+// -----------
+std::vector<float> cost_buffer::mean(channel c) const {
+	std::vector<float> values(nx * ny);
+	for (int i = 0; i < nx * ny; i++)
+		values[i] = samples > 0 ? float(sums[c][i] / samples) : 0.0f;
+	return values;
+}
+
+// writes base.time.png, base.time.pfm, base.steps.png and base.steps.pfm
+bool cost_buffer::write(const std::string& base) const {
+	const char* names[channel_count] = { "time", "steps" };
+	bool ok = true;
+	for (int c = 0; c < channel_count; c++) {
+		std::vector<float> values = mean(channel(c));
+		std::vector<float> sorted = values;
+		size_t rank = size_t(0.99 * (sorted.size() - 1));
+		std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+		float scale = sorted[rank] > 0 ? 1 / sorted[rank] : 0;
+		std::vector<unsigned char> pixels(3 * nx * ny);
+		for (int i = 0; i < nx * ny; i++) {
+			vec3 color = false_color(values[i] * scale);
+			for (int k = 0; k < 3; k++)
+				pixels[3 * i + k] = (unsigned char)(255.99f * color[k]);
+		}
+		std::string path = base + "." + names[c];
+		ok = stbi_write_png((path + ".png").c_str(), nx, ny, 3, pixels.data(), 3 * nx) != 0 && ok;
+		ok = write_pfm(path + ".pfm", values, nx, ny) && ok;
+	}
+	return ok;
+}
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include <float.h>
 #include "aabb.h"
 
+class affine;
 class material;
 
 struct hit_record {
@@ -11,12 +12,18 @@ struct hit_record {
 	vec3 p;
 	vec3 normal;
 	material* mat_ptr;
+	float uv_scale;	// change of u and v per unit of distance on the surface
+	float uv_width;	// footprint of the path in uv space, filled in by the integrator
 };
 
 class hittable {
 public:
+	virtual ~hittable() {}
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const = 0;
 	virtual bool bounding_box(float t0, float t1, aabb& box) const = 0;
+	// v is unit length
 	virtual float pdf_value(const vec3& o, const vec3& v) const { return 0.0; }
 	virtual vec3 random(const vec3& o) const { return vec3(1, 0, 0); }
+	// wrappers that only apply an affine transform return their child
+	virtual hittable* as_transform(affine& to_world) const { return 0; }
 };
\ No newline at end of file
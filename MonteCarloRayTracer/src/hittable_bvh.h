@@ -0,0 +1,190 @@
+#pragma once
+#include <typeinfo>
+#include <vector>
+#include "box.h"
+#include "flat_bvh.h"
+#include "hittable.h"
+#include "rect.h"
+#include "sphere.h"
+#include "stats.h"
+#include "transform.h"
+#include "triangle.h"
+
+// flat bvh over arbitrary hittables, used as the top level of the scene in
+// place of the linear hittable_list. objects without a bounding box are kept
+// aside and tested on every ray. the built in primitives are copied into one
+// array per type and the leaves dispatch on a tag, so their hit functions are
+// called directly instead of through the vtable.
+class hittable_bvh : public hittable {
+public:
+	hittable_bvh() {}
+	hittable_bvh(hittable** l, int n);
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+	virtual bool bounding_box(float t0, float t1, aabb& box) const override;
+
+private:
+	enum primitive_kind {
+		primitive_other, primitive_sphere, primitive_xy_rect, primitive_xz_rect, primitive_yz_rect, primitive_box, primitive_triangle
+	};
+
+	struct primitive {
+		primitive_kind kind;
+		bool flip;
+		int index;
+	};
+
+	primitive add_primitive(hittable* p);
+	bool hit_primitive(const primitive& p, const ray& r, float t_min, float t_max, hit_record& rec) const;
+
+	std::vector<primitive> objects;
+	std::vector<sphere> spheres;
+	std::vector<xy_rect> xy_rects;
+	std::vector<xz_rect> xz_rects;
+	std::vector<yz_rect> yz_rects;
+	std::vector<box> boxes;
+	std::vector<Triangle> triangles;
+	std::vector<hittable*> others;
+	std::vector<hittable*> unbounded;
+	std::vector<flat_bvh_node> nodes;
+};
+
+hittable_bvh::hittable_bvh(hittable** l, int n) {
+	std::vector<aabb> bounds;
+	std::vector<hittable*> bounded;
+	for (int i = 0; i < n; i++) {
+		aabb box;
+		if (l[i]->bounding_box(0, 1, box)) {
+			bounds.push_back(box);
+			bounded.push_back(l[i]);
+		}
+		else
+			unbounded.push_back(l[i]);
+	}
+	std::vector<int> order;
+	build_flat_bvh(bounds, nodes, order);
+	objects.resize(order.size());
+	for (size_t i = 0; i < order.size(); i++)
+		objects[i] = add_primitive(bounded[order[i]]);
+}
+
+// only exact types are copied: a subclass of sphere or of a rect may override
+// hit, and a copy would slice it to the base, so it goes through the vtable
+hittable_bvh::primitive hittable_bvh::add_primitive(hittable* p) {
+	primitive prim;
+	hittable* original = p;
+	prim.flip = false;
+	if (typeid(*p) == typeid(flip_normals)) {
+		prim.flip = true;
+		p = static_cast<flip_normals*>(p)->child();
+	}
+	const std::type_info& type = typeid(*p);
+	if (type == typeid(sphere)) {
+		prim.kind = primitive_sphere;
+		prim.index = int(spheres.size());
+		spheres.push_back(*static_cast<sphere*>(p));
+	}
+	else if (type == typeid(xy_rect)) {
+		prim.kind = primitive_xy_rect;
+		prim.index = int(xy_rects.size());
+		xy_rects.push_back(*static_cast<xy_rect*>(p));
+	}
+	else if (type == typeid(xz_rect)) {
+		prim.kind = primitive_xz_rect;
+		prim.index = int(xz_rects.size());
+		xz_rects.push_back(*static_cast<xz_rect*>(p));
+	}
+	else if (type == typeid(yz_rect)) {
+		prim.kind = primitive_yz_rect;
+		prim.index = int(yz_rects.size());
+		yz_rects.push_back(*static_cast<yz_rect*>(p));
+	}
+	else if (type == typeid(box)) {
+		prim.kind = primitive_box;
+		prim.index = int(boxes.size());
+		boxes.push_back(*static_cast<box*>(p));
+	}
+	else if (type == typeid(Triangle)) {
+		prim.kind = primitive_triangle;
+		prim.index = int(triangles.size());
+		triangles.push_back(*static_cast<Triangle*>(p));
+	}
+	else {
+		// anything else keeps its wrapper and goes through the vtable
+		prim.kind = primitive_other;
+		prim.index = int(others.size());
+		prim.flip = false;
+		others.push_back(original);
+	}
+	return prim;
+}
+
+inline bool hittable_bvh::hit_primitive(const primitive& p, const ray& r, float t_min, float t_max, hit_record& rec) const {
+	bool hit;
+	switch (p.kind) {
+	case primitive_sphere: hit = spheres[p.index].sphere::hit(r, t_min, t_max, rec); break;
+	case primitive_xy_rect: hit = xy_rects[p.index].xy_rect::hit(r, t_min, t_max, rec); break;
+	case primitive_xz_rect: hit = xz_rects[p.index].xz_rect::hit(r, t_min, t_max, rec); break;
+	case primitive_yz_rect: hit = yz_rects[p.index].yz_rect::hit(r, t_min, t_max, rec); break;
+	case primitive_box: hit = boxes[p.index].box::hit(r, t_min, t_max, rec); break;
+	case primitive_triangle: hit = triangles[p.index].Triangle::hit(r, t_min, t_max, rec); break;
+	default: hit = others[p.index]->hit(r, t_min, t_max, rec); break;
+	}
+	if (hit && p.flip)
+		rec.normal = -rec.normal;
+	return hit;
+}
+
+bool hittable_bvh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+	bool hit_anything = false;
+	float closest_so_far = t_max;
+	for (size_t i = 0; i < unbounded.size(); i++) {
+		if (unbounded[i]->hit(r, t_min, closest_so_far, rec)) {
+			hit_anything = true;
+			closest_so_far = rec.t;
+		}
+	}
+	if (nodes.empty())
+		return hit_anything;
+	int stack[flat_bvh_stack_size];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		int index = stack[--top];
+		STAT_INC(stat_bvh_nodes);
+		const flat_bvh_node& current = nodes[index];
+		if (!current.box.hit(r, t_min, closest_so_far))
+			continue;
+		if (current.count == 0) {
+			if (r.direction()[current.axis] < 0) {
+				stack[top++] = index + 1;
+				stack[top++] = current.offset;
+			}
+			else {
+				stack[top++] = current.offset;
+				stack[top++] = index + 1;
+			}
+			continue;
+		}
+		for (int i = current.offset; i < current.offset + current.count; i++) {
+			if (hit_primitive(objects[i], r, t_min, closest_so_far, rec)) {
+				hit_anything = true;
+				closest_so_far = rec.t;
+			}
+		}
+	}
+	return hit_anything;
+}
+
+bool hittable_bvh::bounding_box(float t0, float t1, aabb& box) const {
+	if (nodes.empty() || !unbounded.empty())
+		return false;
+	box = nodes[0].box;
+	return true;
+}
+
+// scene finalization: collapse transform chains, then build the top level bvh
+hittable* finalize_scene(hittable** list, int n, arena& memory) {
+	for (int i = 0; i < n; i++)
+		list[i] = flatten_transforms(list[i], memory);
+	return memory.make<hittable_bvh>(list, n);
+}
\ No newline at end of file
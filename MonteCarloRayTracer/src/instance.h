@@ -0,0 +1,108 @@
+#pragma once
+#include <vector>
+#include "affine.h"
+#include "flat_bvh.h"
+#include "hittable.h"
+#include "stats.h"
+
+// two level acceleration structure. every instance is just a shared bottom
+// level hittable (usually a mesh bvh) and its world to object transform, and
+// the top level bvh is built over the instance bounds in world space, so many
+// copies of a mesh cost a pointer and a matrix each.
+class instance_bvh : public hittable {
+public:
+	instance_bvh() {}
+	void add(hittable* blas, const affine& to_world);
+	void build();
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+	virtual bool bounding_box(float t0, float t1, aabb& box) const override;
+	int instance_count() const { return int(instances.size()); }
+	size_t memory_usage() const;
+
+private:
+	struct instance {
+		hittable* blas;
+		affine to_object;
+	};
+
+	std::vector<instance> instances;
+	std::vector<aabb> bounds;
+	std::vector<flat_bvh_node> nodes;
+};
+
+void instance_bvh::add(hittable* blas, const affine& to_world) {
+	aabb box;
+	blas->bounding_box(0, 1, box);
+	instance i;
+	i.blas = blas;
+	i.to_object = to_world.inverse();
+	instances.push_back(i);
+	bounds.push_back(to_world.box(box));
+}
+
+void instance_bvh::build() {
+	std::vector<int> order;
+	build_flat_bvh(bounds, nodes, order);
+	std::vector<instance> sorted(instances.size());
+	for (size_t i = 0; i < order.size(); i++)
+		sorted[i] = instances[order[i]];
+	instances.swap(sorted);
+	std::vector<aabb>().swap(bounds);
+}
+
+bool instance_bvh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+	if (nodes.empty())
+		return false;
+	int stack[flat_bvh_stack_size];
+	int top = 0;
+	stack[top++] = 0;
+	bool hit_anything = false;
+	float closest_so_far = t_max;
+	hit_record temp_rec;
+	while (top > 0) {
+		int index = stack[--top];
+		STAT_INC(stat_bvh_nodes);
+		const flat_bvh_node& current = nodes[index];
+		if (!current.box.hit(r, t_min, closest_so_far))
+			continue;
+		if (current.count == 0) {
+			if (r.direction()[current.axis] < 0) {
+				stack[top++] = index + 1;
+				stack[top++] = current.offset;
+			}
+			else {
+				stack[top++] = current.offset;
+				stack[top++] = index + 1;
+			}
+			continue;
+		}
+		for (int i = current.offset; i < current.offset + current.count; i++) {
+			const instance& inst = instances[i];
+			// the object space ray is renormalized, scale maps world t to object t
+			vec3 direction = inst.to_object.vector(r.direction());
+			float scale = direction.length();
+			ray object_r(inst.to_object.point(r.origin()), direction / scale, r.time(), already_unit);
+			if (inst.blas->hit(object_r, t_min * scale, closest_so_far * scale, temp_rec)) {
+				hit_anything = true;
+				closest_so_far = temp_rec.t / scale;
+				rec = temp_rec;
+				rec.t = closest_so_far;
+				rec.uv_scale *= scale;
+				rec.p = r.point_at_parameter(closest_so_far);
+				rec.normal = unit_vector(inst.to_object.transposed_vector(temp_rec.normal));
+			}
+		}
+	}
+	return hit_anything;
+}
+
+bool instance_bvh::bounding_box(float t0, float t1, aabb& box) const {
+	if (nodes.empty())
+		return false;
+	box = nodes[0].box;
+	return true;
+}
+
+size_t instance_bvh::memory_usage() const {
+	return instances.size() * sizeof(instance) + nodes.size() * sizeof(flat_bvh_node);
+}
\ No newline at end of file
@@ -1,166 +1,152 @@
 #include "rect.h"
+#include "aov.h"
 #include "box.h"
 #include "bvh.h"
+#include "bvh_cache.h"
 #include "camera.h"
+#include "denoise.h"
+#include "environment.h"
+#include "framebuffer.h"
+#include "heatmap.h"
+#include "hittable_bvh.h"
 #include "hittable_list.h"
+#include "instance.h"
 #include "material.h"
+#include "material_table.h"
 #include "mesh.h"
 #include "model.h"
 #include "pdf.h"
 #include "random.h"
+#include "reference.h"
+#include "render.h"
+#include "sbvh.h"
+#include "scene.h"
+#include "settings.h"
+#include "stats.h"
+#include "trace.h"
 #include "sphere.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
 #include "texture.h"
+#include "texture_cache.h"
 #include "transform.h"
 #include "triangle.h"
 #include "vertex.h"
 
 #include <float.h>
-#include <time.h>
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <fstream>
+#include <thread>
 using namespace std;
 
-inline vec3 de_nan(const vec3& c) {
-	vec3 temp = c;
-	if (!(temp[0] == temp[0])) temp[0] = 0;
-	if (!(temp[1] == temp[1])) temp[1] = 0;
-	if (!(temp[2] == temp[2])) temp[2] = 0;
-	return temp;
-}
+int main(int argc, char** argv) {
+	render_settings settings;
+	if (!parse_render_settings(argc, argv, settings)) {
+		print_usage(argv[0]);
+		return 1;
+	}
+	if (!settings.trace_path.empty())
+		trace_start();
 
-vec3 color(const ray& r, hittable* scene, hittable* light_shape, int depth) {
-	hit_record hrec;
-	if (scene->hit(r, 0.001, FLT_MAX, hrec)) {
-		vec3 emitted = hrec.mat_ptr->emitted(r, hrec, hrec.u, hrec.v, hrec.p);
+	// set scene, the command line overrides what the file asks for
+	scene description;
+	if (!load_scene(settings.scene_path, description))
+		return 1;
+	if (settings.nx > 0)
+		description.nx = settings.nx;
+	if (settings.ny > 0)
+		description.ny = settings.ny;
+	int nx = description.nx;
+	int ny = description.ny;
+	int ns = settings.ns > 0 ? settings.ns : description.ns;
+	camera* cam = description.make_camera();
+	hittable* scene = description.world;
+	hittable* light_shape = description.light_shape;
+	environment_map* environment = description.environment;
 
-		scatter_record srec;
-		if (depth < 50 && hrec.mat_ptr->scatter(r, hrec, srec)) {
-			if (srec.is_specular) {
-				return srec.attenuation * color(srec.specular_ray, scene, light_shape, depth + 1);
-			}
-			else {
-				hittable_pdf plight(light_shape, hrec.p);
-				mixture_pdf p(&plight, srec.pdf_ptr);
-				ray scattered = ray(hrec.p, p.generate(), r.time());
-				float pdf_val = p.value(scattered.direction());
-				delete srec.pdf_ptr;
-				return emitted
-					+ srec.attenuation * hrec.mat_ptr->scattering_pdf(r, hrec, scattered)
-					* color(scattered, scene, light_shape, depth + 1)
-					/ pdf_val;
-			}
-		}
-		else
-			return emitted;
+	// render passes until ns samples, or until the next pass would not fit the budget
+	framebuffer image(nx, ny);
+	cost_buffer* costs = settings.heatmap ? new cost_buffer(nx, ny) : 0;
+	aov_buffer* aovs = settings.aovs || settings.denoise ? new aov_buffer(nx, ny) : 0;
+	phase_timer render_time(phase_render);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	double elapsed = 0, last_pass = 0;
+	for (int pass = 0; pass < ns; pass++) {
+		if (settings.time_budget > 0 && pass > 0 && elapsed + last_pass > settings.time_budget)
+			break;
+		TRACE_SCOPE("pass", "pass", pass);
+		render_pass(cam, scene, light_shape, environment, settings, pass, image, costs, aovs);
+		double now = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		last_pass = now - elapsed;
+		elapsed = now;
 	}
-	else
-		return vec3(0, 0, 0);
-}
-
-hittable* import_model(string path, material* mat) {
-	Model model(path);
-	vector<Triangle*> triangles;
-	for (unsigned int i = 0; i < model.meshes.size(); i++) {
-		Mesh mesh = model.meshes[i];
-		for (unsigned int j = 0; j < mesh.indices.size() - 2; j += 3) {
-			Triangle* triangle = new Triangle(
-				mesh.vertices[mesh.indices[j]],
-				mesh.vertices[mesh.indices[j + 1]],
-				mesh.vertices[mesh.indices[j + 2]],
-				mat
-			);
-			triangles.push_back(triangle);
+	render_time.stop();
+	delete cam;
+	vector<vec3> denoised;
+	if (settings.denoise) {
+		phase_timer denoise_time(phase_denoise);
+		TRACE_SCOPE("denoise", settings.output_path);
+		denoise_settings filter;
+		filter.threads = settings.threads;
+		denoised = denoise(image, *aovs, filter);
+	}
+	phase_timer write_time(phase_write);
+	{
+		TRACE_SCOPE("write image", settings.output_path);
+		bool written = settings.denoise ? write_image(settings.output_path, settings.format, denoised, nx, ny) : image.write(settings.output_path, settings.format);
+		if (!written) {
+			cerr << "cannot write " << settings.format << " image " << settings.output_path << endl;
+			return 1;
 		}
 	}
-	unsigned int triangles_size = triangles.size();
-	hittable** triangles_list = new hittable* [triangles_size];
-	for (unsigned int i = 0; i < triangles_size; i++) {
-		triangles_list[i] = triangles[i];
+	// the heatmap and aovs go next to the image, named after it
+	size_t dot = settings.output_path.find_last_of('.');
+	size_t slash = settings.output_path.find_last_of("/\\");
+	string base = dot != string::npos && (slash == string::npos || dot > slash) ? settings.output_path.substr(0, dot) : settings.output_path;
+	if (costs) {
+		TRACE_SCOPE("write heatmap", settings.output_path);
+		if (!costs->write(base))
+			cerr << "cannot write heatmap " << base << ".time/.steps" << endl;
+		delete costs;
 	}
-	return new bvh_node(triangles_list, triangles_size, 0, 1);
-}
-
-void cornell_box(hittable** scene) {
-	// materials
-	material* red = new lambertian(new constant_texture(vec3(0.65, 0.05, 0.05)));
-	material* white = new lambertian(new constant_texture(vec3(0.73, 0.73, 0.73)));
-	material* green = new lambertian(new constant_texture(vec3(0.12, 0.45, 0.15)));
-	material* blue = new lambertian(new constant_texture(vec3(0, 0, 1)));
-	material* light = new diffuse_light(new constant_texture(vec3(15, 15, 15)));
-	material* met = new metal(vec3(0.7, 0.6, 0.5), 1.0);
-	material* glass = new dielectric(1.5);
-
-	hittable** list = new hittable* [10];
-	int i = 0;
-	hittable* sphere = import_model("resources/sphere.obj", glass);
-	hittable* cylinder = import_model("resources/cylinder.obj", met);
-	list[i++] = new translate(sphere, vec3(200, 100, 200));
-	list[i++] = new translate(cylinder, vec3(400, 0, 380));
-	list[i++] = new flip_normals(new yz_rect(0, 555, 0, 555, 555, green));
-	list[i++] = new yz_rect(0, 555, 0, 555, 0, red);
-	list[i++] = new flip_normals(new xz_rect(213, 343, 227, 332, 554, light));
-	list[i++] = new flip_normals(new xz_rect(0, 555, 0, 555, 555, white));
-	list[i++] = new xz_rect(0, 555, 0, 555, 0, white);
-	list[i++] = new flip_normals(new xy_rect(0, 555, 0, 555, 555, white));
-	//list[i++] = new translate(new rotate_y(new box(vec3(0, 0, 0), vec3(165, 330, 165), met), 15), vec3(265, 0, 295));
-	*scene = new hittable_list(list, i);
-}
-
-int main() {
-	int nx = 500;
-	int ny = 500;
-	int ns = 10000;
-
-	// set camera
-	vec3 lookfrom(278, 278, -800);
-	vec3 lookat(278, 278, 0);
-	float dist_to_focus = 10.0;
-	float aperture = 0.0;
-	float vfov = 40.0;
-	float aspect = float(ny) / float(nx);
-	camera* cam = new camera(lookfrom, lookat, vec3(0, 1, 0), vfov, aspect, aperture, dist_to_focus, 0.0, 1.0);
-
-	// set scene
-	hittable* scene;
-	cornell_box(&scene);
-	hittable* light_shape = new xz_rect(213, 343, 227, 332, 554, 0);
-
-	// write header to ppm file
-	ofstream os;
-	os.open("img/scene.ppm");
-	os << "P3\n" << nx << " " << ny << "\n255\n";
+	if (aovs) {
+		TRACE_SCOPE("write aovs", settings.output_path);
+		if (settings.aovs && !aovs->write(base))
+			cerr << "cannot write aovs " << base << ".albedo/.normal/.depth" << endl;
+		delete aovs;
+	}
+	if (!settings.reference_path.empty() && !make_reference(image).write(settings.reference_path))
+		cerr << "cannot write reference " << settings.reference_path << endl;
+	write_time.stop();
+	if (!settings.trace_path.empty() && !trace_write(settings.trace_path))
+		cerr << "cannot write trace " << settings.trace_path << endl;
 
-	// write data to ppm file
-	clock_t start = clock();
-	for (int j = ny - 1; j >= 0; j--) {
-		for (int i = 0; i < nx; i++) {
-			vec3 col(0, 0, 0);
-			for (int s = 0; s < ns; s++) {
-				float u = float(i + random_double()) / float(nx);
-				float v = float(j + random_double()) / float(ny);
-				ray r = cam->get_ray(u, v);
-				vec3 p = r.point_at_parameter(2.0);
-				col += de_nan(color(r, scene, light_shape, 0));
-			}
-			col /= float(ns);
-			col = vec3(sqrt(col[0]), sqrt(col[1]), sqrt(col[2]));
-			int ir = int(255.99 * col[0]);
-			int ig = int(255.99 * col[1]);
-			int ib = int(255.99 * col[2]);
-			os << ir << " " << ig << " " << ib << "\n";
+	// a failed comparison still reports the stats, then exits with 1
+	bool matches = true;
+	if (!settings.compare_path.empty()) {
+		reference_image reference;
+		if (!reference.read(settings.compare_path)) {
+			cerr << "cannot read reference " << settings.compare_path << endl;
+			matches = false;
 		}
+		else
+			matches = compare_to_reference(image, reference, reference_test(), cout);
 	}
-	os.close();
-	clock_t end = clock();
 
 	cout << "width: " << nx << endl;
 	cout << "height: " << ny << endl;
-	cout << "samples per pixel: " << ns << endl;
-	long running_time = (end - start) / CLOCKS_PER_SEC;
+	cout << "samples per pixel: " << image.sample_count() << endl;
+	cout << "threads: " << settings.threads << endl;
+	long running_time = long(elapsed);
 	long minute = running_time / 60;
-	long second = running_time % 60;	
+	long second = running_time % 60;
 	cout << "running time: " << minute << "m " << second << "s" << endl;
-	return 0;
+	print_stats(cout);
+	if (description.tiles)
+		description.tiles->report(cout);
+	return matches ? 0 : 1;
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "pdf.h"
 #include "random.h"
 #include "ray.h"
+#include "stats.h"
 #include "texture.h"
 
 float schlick(float cosine, float ref_idx) {
@@ -12,8 +13,9 @@ float schlick(float cosine, float ref_idx) {
 	return r0 + (1 - r0) * pow((1 - cosine), 5);
 }
 
+// v and n are unit length, so is refracted
 bool refract(const vec3& v, const vec3& n, float ni_over_nt, vec3& refracted) {
-	vec3 uv = unit_vector(v);
+	const vec3& uv = v;
 	float dt = dot(uv, n);
 	float discriminant = 1.0 - ni_over_nt * ni_over_nt * (1 - dt * dt);
 	if (discriminant > 0) {
@@ -35,35 +37,48 @@ struct scatter_record {
 	pdf* pdf_ptr;
 };
 
+// tag of the built in materials, used by the static dispatch below. they are
+// final, so a tagged material is always exactly the class its tag names
+enum material_kind {
+	material_other, material_dielectric, material_metal, material_lambertian, material_diffuse_light
+};
+
 class material {
 public:
+	material() : kind(material_other) {}
 	virtual bool scatter(const ray& r_in, const hit_record& hrec, scatter_record& srec) const { return false; }
 	virtual float scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const { return 0; }
 	virtual vec3 emitted(const ray& r_in, const hit_record& rec, float u, float v, const vec3& p) const { return vec3(0, 0, 0); }
+	const material_kind kind;
+
+protected:
+	explicit material(material_kind k) : kind(k) {}
 };
 
-class dielectric : public material {
+class dielectric final : public material {
 public:
-	dielectric(float ri) : ref_idx(ri) {}
+	dielectric(float ri) : material(material_dielectric), ref_idx(ri) {}
 	virtual bool scatter(const ray& r_in, const hit_record& hrec, scatter_record& srec) const override;
 
 private:
 	float ref_idx;
 };
 
-class metal : public material {
+class metal final : public material {
 public:
-	metal(const vec3& a, float f) : albedo(a) { if (f < 1) fuzz = f; else fuzz = 1; }
+	metal(const vec3& a, float f) : material(material_metal), albedo(a), albedo_map(0) { if (f < 1) fuzz = f; else fuzz = 1; }
+	metal(texture* a, float f) : material(material_metal), albedo_map(a) { if (f < 1) fuzz = f; else fuzz = 1; }
 	virtual bool scatter(const ray& r_in, const hit_record& hrec, scatter_record& srec) const override;
 
 private:
 	vec3 albedo;
+	texture* albedo_map;	// replaces albedo if set
 	float fuzz;
 };
 
-class lambertian : public material {
+class lambertian final : public material {
 public:
-	lambertian(texture* a) : albedo(a) {}
+	lambertian(texture* a) : material(material_lambertian), albedo(a) {}
 	virtual float scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const override;
 	virtual bool scatter(const ray& r_in, const hit_record& hrec, scatter_record& srec) const override;
 
@@ -71,9 +86,9 @@ private:
 	texture* albedo;
 };
 
-class diffuse_light : public material {
+class diffuse_light final : public material {
 public:
-	diffuse_light(texture* a) : emit(a) {}
+	diffuse_light(texture* a) : material(material_diffuse_light), emit(a) {}
 	virtual vec3 emitted(const ray& r_in, const hit_record& rec, float u, float v, const vec3& p) const override;
 
 private:
@@ -93,12 +108,12 @@ bool dielectric::scatter(const ray& r_in, const hit_record& hrec, scatter_record
 	if (dot(r_in.direction(), hrec.normal) > 0) {
 		normal = -hrec.normal;
 		ni_over_nt = ref_idx;
-		cosine = ref_idx * dot(r_in.direction(), hrec.normal) / r_in.direction().length();
+		cosine = ref_idx * dot(r_in.direction(), hrec.normal);
 	}
 	else {
 		normal = hrec.normal;
 		ni_over_nt = 1.0 / ref_idx;
-		cosine = -dot(r_in.direction(), hrec.normal) / r_in.direction().length();
+		cosine = -dot(r_in.direction(), hrec.normal);
 	}
 
 	vec3 reflected = reflect(r_in.direction(), hrec.normal);
@@ -110,18 +125,18 @@ bool dielectric::scatter(const ray& r_in, const hit_record& hrec, scatter_record
 		reflect_prob = 1.0;
 
 	if (random_double() < reflect_prob)
-		srec.specular_ray = ray(hrec.p, reflected);
+		srec.specular_ray = ray(hrec.p, reflected, r_in.time(), already_unit);
 	else
-		srec.specular_ray = ray(hrec.p, refracted);
+		srec.specular_ray = ray(hrec.p, refracted, r_in.time(), already_unit);
 	return true;
 }
 
 // metal material
 // --------------
 bool metal::scatter(const ray& r_in, const hit_record& hrec, scatter_record& srec) const {
-	vec3 reflected = reflect(unit_vector(r_in.direction()), hrec.normal);
-	srec.specular_ray = ray(hrec.p, reflected + fuzz * random_in_unit_sphere());
-	srec.attenuation = albedo;
+	vec3 reflected = reflect(r_in.direction(), hrec.normal);
+	srec.specular_ray = ray(hrec.p, reflected + fuzz * random_in_unit_sphere(), r_in.time());
+	srec.attenuation = albedo_map ? albedo_map->value(hrec.u, hrec.v, hrec.p, hrec.uv_width) : albedo;
 	srec.is_specular = true;
 	srec.pdf_ptr = 0;
 	return true;
@@ -130,7 +145,7 @@ bool metal::scatter(const ray& r_in, const hit_record& hrec, scatter_record& sre
 // lambertian material
 // -------------------
 float lambertian::scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const {
-	float cosine = dot(rec.normal, unit_vector(scattered.direction()));
+	float cosine = dot(rec.normal, scattered.direction());
 	if (cosine < 0)
 		return 0;
 	return cosine / M_PI;
@@ -138,7 +153,7 @@ float lambertian::scattering_pdf(const ray& r_in, const hit_record& rec, const r
 
 bool lambertian::scatter(const ray& r_in, const hit_record& hrec, scatter_record& srec) const {
 	srec.is_specular = false;
-	srec.attenuation = albedo->value(hrec.u, hrec.v, hrec.p);
+	srec.attenuation = albedo->value(hrec.u, hrec.v, hrec.p, hrec.uv_width);
 	srec.pdf_ptr = new cosine_pdf(hrec.normal);
 	return true;
 }
@@ -147,7 +162,42 @@ bool lambertian::scatter(const ray& r_in, const hit_record& hrec, scatter_record
 // ----------------------
 vec3 diffuse_light::emitted(const ray& r_in, const hit_record& rec, float u, float v, const vec3& p) const {
 	if (dot(rec.normal, r_in.direction()) < 0.0)
-		return emit->value(u, v, p);
+		return emit->value(u, v, p, rec.uv_width);
 	else
 		return vec3(0, 0, 0);
+}
+
+// static dispatch
+// ---------------
+// qualified calls on the known material types can be inlined, anything else
+// goes through the virtual interface
+inline bool material_scatter(const material* m, const ray& r_in, const hit_record& hrec, scatter_record& srec) {
+	STAT_INC(stat_counter(stat_scatter_other + m->kind));
+	switch (m->kind) {
+	case material_dielectric: return static_cast<const dielectric*>(m)->dielectric::scatter(r_in, hrec, srec);
+	case material_metal: return static_cast<const metal*>(m)->metal::scatter(r_in, hrec, srec);
+	case material_lambertian: return static_cast<const lambertian*>(m)->lambertian::scatter(r_in, hrec, srec);
+	case material_diffuse_light: return false;
+	default: return m->scatter(r_in, hrec, srec);
+	}
+}
+
+inline float material_scattering_pdf(const material* m, const ray& r_in, const hit_record& rec, const ray& scattered) {
+	switch (m->kind) {
+	case material_lambertian: return static_cast<const lambertian*>(m)->lambertian::scattering_pdf(r_in, rec, scattered);
+	case material_dielectric:
+	case material_metal:
+	case material_diffuse_light: return 0;
+	default: return m->scattering_pdf(r_in, rec, scattered);
+	}
+}
+
+inline vec3 material_emitted(const material* m, const ray& r_in, const hit_record& rec, float u, float v, const vec3& p) {
+	switch (m->kind) {
+	case material_diffuse_light: return static_cast<const diffuse_light*>(m)->diffuse_light::emitted(r_in, rec, u, v, p);
+	case material_dielectric:
+	case material_metal:
+	case material_lambertian: return vec3(0, 0, 0);
+	default: return m->emitted(r_in, rec, u, v, p);
+	}
 }
\ No newline at end of file
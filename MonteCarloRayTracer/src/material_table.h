@@ -0,0 +1,112 @@
+#pragma once
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "arena.h"
+#include "material.h"
+#include "mesh.h"
+#include "stb_image.h"
+#include "texture.h"
+
+// the MTL data a mesh carries, turned into a renderer material by
+// make_material. a model keeps one entry per distinct material and its
+// triangles refer to them by index into a material_table.
+struct material_description {
+	material_description() : shininess(0), refracti(1), opacity(1), type(DIFFUSE) {}
+	material_description(const Mesh& mesh);
+	bool operator==(const material_description& other) const;
+
+	vec3 ka, kd, ks;
+	float shininess, refracti, opacity;
+	MATERIAL_TYPE type;
+	std::string diffuse_map, specular_map;
+};
+
+typedef std::vector<material*> material_table;
+
+// image textures by path, so maps shared between materials and models are
+// decoded and mip mapped once. safe to use from several loading threads: the
+// lock only guards the map, the first thread to ask for a path decodes it and
+// the others wait on its entry.
+class texture_library {
+public:
+	texture* load(const std::string& path, bool srgb);
+	int size() const { return int(textures.size()); }
+
+private:
+	std::map<std::string, std::shared_future<texture*> > textures;
+	std::mutex lock;
+};
+
+material* make_material(const material_description& description, texture_library& textures, arena& memory);
+
+// material description
+// --------------------
+material_description::material_description(const Mesh& mesh) : ka(mesh.ka), kd(mesh.kd), ks(mesh.ks), shininess(mesh.shininess), refracti(mesh.refracti),
+	opacity(mesh.opacity), type(mesh.type), diffuse_map(mesh.diffuse_map), specular_map(mesh.specular_map) {}
+
+bool material_description::operator==(const material_description& other) const {
+	for (int i = 0; i < 3; i++) {
+		if (ka[i] != other.ka[i] || kd[i] != other.kd[i] || ks[i] != other.ks[i])
+			return false;
+	}
+	return shininess == other.shininess && refracti == other.refracti && opacity == other.opacity && type == other.type
+		&& diffuse_map == other.diffuse_map && specular_map == other.specular_map;
+}
+
+// texture library
+// ---------------
+// returns 0 if the image cannot be read, and remembers that too
+texture* texture_library::load(const std::string& path, bool srgb) {
+	std::string key = path + (srgb ? "#srgb" : "#linear");
+	std::promise<texture*> decoded;
+	std::shared_future<texture*> entry;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		std::map<std::string, std::shared_future<texture*> >::iterator it = textures.find(key);
+		if (it != textures.end())
+			entry = it->second;
+		else
+			textures[key] = decoded.get_future().share();
+	}
+	if (entry.valid())
+		return entry.get();
+	// stbi_load is reentrant but for its failure string, which is never read
+	int nx, ny, channels;
+	unsigned char* pixels = stbi_load(path.c_str(), &nx, &ny, &channels, 3);
+	texture* t = 0;
+	if (pixels) {
+		t = new image_texture(pixels, nx, ny, srgb);
+		stbi_image_free(pixels);
+	}
+	else
+		std::cerr << "cannot load texture " << path << std::endl;
+	decoded.set_value(t);
+	return t;
+}
+
+// make material
+// -------------
+// ka is ambient in MTL files and not emission, so it is ignored. a phong
+// exponent maps to metal fuzz with the usual beckmann roughness sqrt(2 / (n + 2)).
+// translucent materials have no renderer counterpart yet and become glass.
+material* make_material(const material_description& description, texture_library& textures, arena& memory) {
+	texture* diffuse = description.diffuse_map.empty() ? 0 : textures.load(description.diffuse_map, true);
+	texture* specular = description.specular_map.empty() ? 0 : textures.load(description.specular_map, true);
+	switch (description.type) {
+	case SPECULAR: {
+		float fuzz = sqrt(2.0f / (description.shininess + 2.0f));
+		if (specular)
+			return memory.make<metal>(specular, fuzz);
+		return memory.make<metal>(description.ks, fuzz);
+	}
+	case REFRACTIVE:
+		return memory.make<dielectric>(description.refracti);
+	case PLASTIC:
+		return memory.make<dielectric>(description.refracti > 1.0f ? description.refracti : 1.5f);
+	default:
+		return memory.make<lambertian>(diffuse ? diffuse : memory.make<constant_texture>(description.kd));
+	}
+}
\ No newline at end of file
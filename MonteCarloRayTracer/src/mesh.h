@@ -1,7 +1,4 @@
 #pragma once
-#include <assimp/Importer.hpp>
-#include <assimp/scene.h>
-#include <assimp/postprocess.h>
 #include <iostream>
 #include <vector>
 #include "vertex.h"
@@ -18,6 +15,7 @@ public:
 	vec3 ka, kd, ks;
 	float shininess, refracti, opacity;
 	MATERIAL_TYPE type;
+	string diffuse_map, specular_map;	// image paths, empty if untextured
 
 	Mesh(
 		const vector<Vertex>& vertices,
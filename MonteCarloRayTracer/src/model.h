@@ -1,5 +1,15 @@
 #pragma once
-#include "Mesh.h"
+// build with RENDER_ASSIMP=0 to drop assimp, then only obj models load
+#ifndef RENDER_ASSIMP
+#define RENDER_ASSIMP 1
+#endif
+#if RENDER_ASSIMP
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+#endif
+#include "mesh.h"
+#include "obj_loader.h"
 #include "vec3.h"
 
 class Model {
@@ -13,16 +23,26 @@ public:
 
 private:
 	void loadModel(const string& path) {
+		// wavefront obj has a native loader, assimp handles everything else
+		if (path.size() > 4 && path.compare(path.size() - 4, 4, ".obj") == 0 && load_obj(path, meshes)) {
+			directory = path.substr(0, path.find_last_of('/'));
+			return;
+		}
+#if RENDER_ASSIMP
 		Assimp::Importer importer;
-		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate);
 		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
 			cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
 			return;
 		}
 		directory = path.substr(0, path.find_last_of('/'));
 		processNode(scene->mRootNode, scene);
+#else
+		cout << "ERROR::MODEL:: " << path << " needs assimp, which this build leaves out" << endl;
+#endif
 	}
 
+#if RENDER_ASSIMP
 	void processNode(aiNode* node, const aiScene* scene) {
 		for (unsigned int i = 0; i < node->mNumMeshes; i++) {
 			aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
@@ -40,6 +60,7 @@ private:
 		vec3 ka, kd, ks;
 		float shininess, refracti, opacity;
 		MATERIAL_TYPE type;
+		string diffuse_map, specular_map;
 
 		ka = vec3(0.0f, 0.0f, 0.0f);
 		kd = vec3(0.0f, 0.0f, 0.0f);
@@ -61,6 +82,9 @@ private:
 			vector.y() = mesh->mNormals[i].y;
 			vector.z() = mesh->mNormals[i].z;
 			vertex.normal = vector;
+			// texture coordinates
+			vertex.u = mesh->mTextureCoords[0] ? mesh->mTextureCoords[0][i].x : 0.0f;
+			vertex.v = mesh->mTextureCoords[0] ? mesh->mTextureCoords[0][i].y : 0.0f;
 			vertices.push_back(vertex);
 		}
 
@@ -94,6 +118,13 @@ private:
 			aiGetMaterialFloatArray(material, AI_MATKEY_REFRACTI, &refracti, &max);
 			aiGetMaterialFloatArray(material, AI_MATKEY_OPACITY, &opacity, &max);
 
+			// fill texture maps, relative to the model
+			aiString file;
+			if (material->GetTexture(aiTextureType_DIFFUSE, 0, &file) == AI_SUCCESS)
+				diffuse_map = directory + '/' + file.C_Str();
+			if (material->GetTexture(aiTextureType_SPECULAR, 0, &file) == AI_SUCCESS)
+				specular_map = directory + '/' + file.C_Str();
+
 			// fill material type
 			if (shininess > 0.0f) {
 				type = SPECULAR;
@@ -106,6 +137,10 @@ private:
 				type = PLASTIC;
 			}
 		}
-		return Mesh(vertices, indices, ka, kd, ks, shininess, refracti, opacity, type);
+		Mesh result(vertices, indices, ka, kd, ks, shininess, refracti, opacity, type);
+		result.diffuse_map = diffuse_map;
+		result.specular_map = specular_map;
+		return result;
 	}
+#endif
 };
\ No newline at end of file
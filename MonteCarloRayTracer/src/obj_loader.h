@@ -0,0 +1,483 @@
+#pragma once
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "vec3.h"
+#include "mesh.h"
+
+// native wavefront obj/mtl loader for the common path. the file is read in one
+// go and split into newline aligned chunks that are parsed in parallel, then
+// every chunk writes its triangles straight into the final Mesh arrays. like
+// assimp with aiProcess_Triangulate, faces are fanned into triangles and every
+// corner becomes its own Vertex, with one Mesh per material.
+const int obj_none = INT_MIN;
+const size_t obj_min_chunk = 1 << 20;
+
+struct obj_material {
+	obj_material() : shininess(0), refracti(1), opacity(1) {}
+	vec3 ka, kd, ks;
+	float shininess, refracti, opacity;
+	std::string diffuse_map, specular_map;
+};
+
+struct obj_corner {
+	int v, vt, vn;
+	bool relative_v, relative_vt, relative_vn;
+};
+
+struct obj_chunk {
+	const char* begin;
+	const char* end;
+	std::vector<float> positions;
+	std::vector<float> texcoords;
+	std::vector<float> normals;
+	std::vector<obj_corner> corners;
+	std::vector<int> triangle_material;
+	// material 0 is whatever was active when the chunk started
+	std::vector<std::string> material_names;
+	std::vector<int> material_triangles;
+	std::vector<int> material_offset;
+	std::vector<int> material_mesh;
+	int current_material;
+	std::string mtllib;
+	size_t position_start, texcoord_start, normal_start;
+};
+
+// number parsing
+// --------------
+inline const char* obj_skip_space(const char* p) {
+	while (*p == ' ' || *p == '\t' || *p == '\r')
+		p++;
+	return p;
+}
+
+inline const char* obj_parse_int(const char* p, int& out) {
+	bool negative = false;
+	if (*p == '-') {
+		negative = true;
+		p++;
+	}
+	else if (*p == '+')
+		p++;
+	int value = 0;
+	while (*p >= '0' && *p <= '9')
+		value = value * 10 + (*p++ - '0');
+	out = negative ? -value : value;
+	return p;
+}
+
+inline const char* obj_parse_float(const char* p, float& out) {
+	static const double powers[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	p = obj_skip_space(p);
+	bool negative = false;
+	if (*p == '-') {
+		negative = true;
+		p++;
+	}
+	else if (*p == '+')
+		p++;
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	while (*p >= '0' && *p <= '9') {
+		if (digits < 18) {
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa)
+				digits++;
+		}
+		else
+			exponent++;
+		p++;
+	}
+	if (*p == '.') {
+		p++;
+		while (*p >= '0' && *p <= '9') {
+			if (digits < 18) {
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa)
+					digits++;
+				exponent--;
+			}
+			p++;
+		}
+	}
+	if (*p == 'e' || *p == 'E') {
+		int e;
+		p = obj_parse_int(p + 1, e);
+		exponent += e;
+	}
+	double value = double(mantissa);
+	if (exponent < 0)
+		value = -exponent <= 22 ? value / powers[-exponent] : value * pow(10.0, exponent);
+	else if (exponent > 0)
+		value = exponent <= 22 ? value * powers[exponent] : value * pow(10.0, exponent);
+	out = float(negative ? -value : value);
+	return p;
+}
+
+inline std::string obj_parse_name(const char* p) {
+	p = obj_skip_space(p);
+	const char* end = p;
+	while (*end && *end != '\n')
+		end++;
+	while (end > p && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+		end--;
+	return std::string(p, end);
+}
+
+inline bool obj_keyword(const char* p, const char* keyword) {
+	size_t n = strlen(keyword);
+	return strncmp(p, keyword, n) == 0 && (p[n] == ' ' || p[n] == '\t');
+}
+
+// chunk parsing
+// -------------
+void obj_parse_chunk(obj_chunk& chunk) {
+	chunk.material_names.assign(1, std::string());
+	chunk.material_triangles.assign(1, 0);
+	chunk.current_material = 0;
+	std::vector<obj_corner> face;
+	const char* p = chunk.begin;
+	while (p < chunk.end) {
+		const char* line_end = (const char*)memchr(p, '\n', chunk.end - p);
+		if (!line_end)
+			line_end = chunk.end;
+		p = obj_skip_space(p);
+		if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+			float x, y, z;
+			p = obj_parse_float(obj_parse_float(obj_parse_float(p + 1, x), y), z);
+			chunk.positions.push_back(x);
+			chunk.positions.push_back(y);
+			chunk.positions.push_back(z);
+		}
+		else if (p[0] == 'v' && p[1] == 't') {
+			float u, v;
+			p = obj_parse_float(obj_parse_float(p + 2, u), v);
+			chunk.texcoords.push_back(u);
+			chunk.texcoords.push_back(v);
+		}
+		else if (p[0] == 'v' && p[1] == 'n') {
+			float x, y, z;
+			p = obj_parse_float(obj_parse_float(obj_parse_float(p + 2, x), y), z);
+			chunk.normals.push_back(x);
+			chunk.normals.push_back(y);
+			chunk.normals.push_back(z);
+		}
+		else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+			face.clear();
+			p = obj_skip_space(p + 1);
+			while (p < line_end && *p != '\n' && *p) {
+				obj_corner c;
+				int index;
+				p = obj_parse_int(p, index);
+				c.relative_v = index < 0;
+				c.v = index < 0 ? int(chunk.positions.size() / 3) + index : index - 1;
+				c.vt = obj_none;
+				c.vn = obj_none;
+				c.relative_vt = false;
+				c.relative_vn = false;
+				if (*p == '/') {
+					p++;
+					if (*p != '/') {
+						p = obj_parse_int(p, index);
+						c.relative_vt = index < 0;
+						c.vt = index < 0 ? int(chunk.texcoords.size() / 2) + index : index - 1;
+					}
+					if (*p == '/') {
+						p = obj_parse_int(p + 1, index);
+						c.relative_vn = index < 0;
+						c.vn = index < 0 ? int(chunk.normals.size() / 3) + index : index - 1;
+					}
+				}
+				face.push_back(c);
+				while (*p && *p != '\n' && *p != ' ' && *p != '\t' && *p != '\r')
+					p++;
+				p = obj_skip_space(p);
+			}
+			for (size_t i = 2; i < face.size(); i++) {
+				chunk.corners.push_back(face[0]);
+				chunk.corners.push_back(face[i - 1]);
+				chunk.corners.push_back(face[i]);
+				chunk.triangle_material.push_back(chunk.current_material);
+				chunk.material_triangles[chunk.current_material]++;
+			}
+		}
+		else if (obj_keyword(p, "usemtl")) {
+			std::string name = obj_parse_name(p + 6);
+			size_t i = 1;
+			while (i < chunk.material_names.size() && chunk.material_names[i] != name)
+				i++;
+			if (i == chunk.material_names.size()) {
+				chunk.material_names.push_back(name);
+				chunk.material_triangles.push_back(0);
+			}
+			chunk.current_material = int(i);
+		}
+		else if (obj_keyword(p, "mtllib") && chunk.mtllib.empty()) {
+			chunk.mtllib = obj_parse_name(p + 6);
+		}
+		p = line_end + 1;
+	}
+}
+
+void obj_write_chunk(const obj_chunk& chunk, const std::vector<float>& positions, const std::vector<float>& texcoords, const std::vector<float>& normals, std::vector<Mesh>& meshes) {
+	std::vector<int> next = chunk.material_offset;
+	for (size_t t = 0; t < chunk.triangle_material.size(); t++) {
+		int local = chunk.triangle_material[t];
+		Mesh& mesh = meshes[chunk.material_mesh[local]];
+		int base = next[local];
+		next[local] += 3;
+		vec3 p[3], n[3];
+		float uv[3][2] = { { 0, 0 }, { 0, 0 }, { 0, 0 } };
+		bool has_normals = true;
+		for (int k = 0; k < 3; k++) {
+			const obj_corner& c = chunk.corners[3 * t + k];
+			size_t v = size_t(c.relative_v ? chunk.position_start + c.v : c.v);
+			if (v < positions.size() / 3)
+				p[k] = vec3(positions[3 * v], positions[3 * v + 1], positions[3 * v + 2]);
+			if (c.vt != obj_none) {
+				size_t vt = size_t(c.relative_vt ? chunk.texcoord_start + c.vt : c.vt);
+				if (vt < texcoords.size() / 2) {
+					uv[k][0] = texcoords[2 * vt];
+					uv[k][1] = texcoords[2 * vt + 1];
+				}
+			}
+			if (c.vn == obj_none) {
+				has_normals = false;
+				continue;
+			}
+			size_t vn = size_t(c.relative_vn ? chunk.normal_start + c.vn : c.vn);
+			if (vn < normals.size() / 3)
+				n[k] = vec3(normals[3 * vn], normals[3 * vn + 1], normals[3 * vn + 2]);
+			else
+				has_normals = false;
+		}
+		if (!has_normals) {
+			vec3 face_normal = cross(p[1] - p[0], p[2] - p[0]);
+			if (face_normal.squared_length() > 0)
+				face_normal.make_unit_vector();
+			n[0] = n[1] = n[2] = face_normal;
+		}
+		for (int k = 0; k < 3; k++) {
+			mesh.vertices[base + k].position = p[k];
+			mesh.vertices[base + k].normal = n[k];
+			mesh.vertices[base + k].u = uv[k][0];
+			mesh.vertices[base + k].v = uv[k][1];
+			mesh.indices[base + k] = base + k;
+		}
+	}
+}
+
+// mtl
+// ---
+// texture options like -s or -bm are skipped, the file name is the last word
+inline std::string obj_parse_map(const char* p, const std::string& directory) {
+	std::string line = obj_parse_name(p);
+	size_t space = line.find_last_of(" \t");
+	return directory + (space == std::string::npos ? line : line.substr(space + 1));
+}
+
+std::map<std::string, obj_material> load_mtl(const std::string& path) {
+	std::map<std::string, obj_material> materials;
+	std::string directory = path.substr(0, path.find_last_of('/') + 1);
+	FILE* file = fopen(path.c_str(), "rb");
+	if (!file)
+		return materials;
+	obj_material* current = 0;
+	char line[1024];
+	while (fgets(line, sizeof(line), file)) {
+		const char* p = obj_skip_space(line);
+		float x, y, z;
+		if (obj_keyword(p, "newmtl"))
+			current = &materials[obj_parse_name(p + 6)];
+		else if (!current)
+			continue;
+		else if (obj_keyword(p, "Ka")) {
+			obj_parse_float(obj_parse_float(obj_parse_float(p + 2, x), y), z);
+			current->ka = vec3(x, y, z);
+		}
+		else if (obj_keyword(p, "Kd")) {
+			obj_parse_float(obj_parse_float(obj_parse_float(p + 2, x), y), z);
+			current->kd = vec3(x, y, z);
+		}
+		else if (obj_keyword(p, "Ks")) {
+			obj_parse_float(obj_parse_float(obj_parse_float(p + 2, x), y), z);
+			current->ks = vec3(x, y, z);
+		}
+		else if (obj_keyword(p, "Ns"))
+			obj_parse_float(p + 2, current->shininess);
+		else if (obj_keyword(p, "Ni"))
+			obj_parse_float(p + 2, current->refracti);
+		else if (obj_keyword(p, "d"))
+			obj_parse_float(p + 1, current->opacity);
+		else if (obj_keyword(p, "map_Kd"))
+			current->diffuse_map = obj_parse_map(p + 6, directory);
+		else if (obj_keyword(p, "map_Ks"))
+			current->specular_map = obj_parse_map(p + 6, directory);
+		else if (obj_keyword(p, "Tr")) {
+			obj_parse_float(p + 2, x);
+			current->opacity = 1 - x;
+		}
+	}
+	fclose(file);
+	return materials;
+}
+
+// same interpretation of the material as Model::processMesh
+Mesh obj_make_mesh(const obj_material& m) {
+	vec3 kd = m.kd;
+	MATERIAL_TYPE type = DIFFUSE;
+	if (m.shininess > 0.0f) {
+		type = SPECULAR;
+		kd = vec3(1.0f, 1.0f, 1.0f);
+	}
+	if (m.refracti > 1.0f) {
+		type = REFRACTIVE;
+	}
+	if (m.opacity < 1.0f) {
+		type = PLASTIC;
+	}
+	Mesh mesh(vector<Vertex>(), vector<int>(), m.ka * 100.0f, kd, m.ks, m.shininess, m.refracti, m.opacity, type);
+	mesh.diffuse_map = m.diffuse_map;
+	mesh.specular_map = m.specular_map;
+	return mesh;
+}
+
+// obj
+// ---
+bool load_obj(const std::string& path, std::vector<Mesh>& meshes) {
+	FILE* file = fopen(path.c_str(), "rb");
+	if (!file)
+		return false;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (size <= 0) {
+		fclose(file);
+		return false;
+	}
+	std::vector<char> data(size_t(size) + 1, 0);
+	size_t read = fread(&data[0], 1, size_t(size), file);
+	fclose(file);
+	if (read != size_t(size))
+		return false;
+
+	// split into newline aligned chunks, one per thread
+	const char* begin = &data[0];
+	const char* end = begin + size;
+	size_t threads = std::thread::hardware_concurrency();
+	threads = std::max<size_t>(1, std::min<size_t>(threads, size / obj_min_chunk));
+	std::vector<obj_chunk> chunks(threads);
+	const char* p = begin;
+	for (size_t i = 0; i < threads; i++) {
+		chunks[i].begin = p;
+		const char* split = i + 1 == threads ? end : begin + size * (i + 1) / threads;
+		if (split < p)
+			split = p;
+		while (split < end && *split != '\n')
+			split++;
+		if (split < end)
+			split++;
+		chunks[i].end = split;
+		p = split;
+	}
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < threads; i++)
+		workers.push_back(std::thread(obj_parse_chunk, std::ref(chunks[i])));
+	obj_parse_chunk(chunks[0]);
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+
+	// gather the vertex data and resolve materials across chunk boundaries
+	std::string directory = path.substr(0, path.find_last_of('/') + 1);
+	std::string mtllib;
+	for (size_t i = 0; i < threads && mtllib.empty(); i++)
+		mtllib = chunks[i].mtllib;
+	std::map<std::string, obj_material> materials;
+	if (!mtllib.empty())
+		materials = load_mtl(directory + mtllib);
+
+	size_t position_count = 0, texcoord_count = 0, normal_count = 0;
+	for (size_t i = 0; i < threads; i++) {
+		chunks[i].position_start = position_count;
+		chunks[i].texcoord_start = texcoord_count;
+		chunks[i].normal_start = normal_count;
+		position_count += chunks[i].positions.size() / 3;
+		texcoord_count += chunks[i].texcoords.size() / 2;
+		normal_count += chunks[i].normals.size() / 3;
+	}
+	std::vector<float> positions, texcoords, normals;
+	positions.reserve(3 * position_count);
+	texcoords.reserve(2 * texcoord_count);
+	normals.reserve(3 * normal_count);
+	for (size_t i = 0; i < threads; i++) {
+		positions.insert(positions.end(), chunks[i].positions.begin(), chunks[i].positions.end());
+		texcoords.insert(texcoords.end(), chunks[i].texcoords.begin(), chunks[i].texcoords.end());
+		normals.insert(normals.end(), chunks[i].normals.begin(), chunks[i].normals.end());
+		std::vector<float>().swap(chunks[i].positions);
+		std::vector<float>().swap(chunks[i].texcoords);
+		std::vector<float>().swap(chunks[i].normals);
+	}
+
+	std::map<std::string, int> mesh_of_name;
+	std::vector<int> mesh_size;
+	size_t first_mesh = meshes.size();
+	std::string active;
+	for (size_t i = 0; i < threads; i++) {
+		obj_chunk& chunk = chunks[i];
+		chunk.material_names[0] = active;
+		chunk.material_mesh.resize(chunk.material_names.size());
+		chunk.material_offset.resize(chunk.material_names.size());
+		for (size_t m = 0; m < chunk.material_names.size(); m++) {
+			std::map<std::string, int>::iterator it = mesh_of_name.find(chunk.material_names[m]);
+			if (it == mesh_of_name.end()) {
+				it = mesh_of_name.insert(std::make_pair(chunk.material_names[m], int(mesh_size.size()))).first;
+				mesh_size.push_back(0);
+			}
+			chunk.material_mesh[m] = it->second;
+			chunk.material_offset[m] = mesh_size[it->second];
+			mesh_size[it->second] += 3 * chunk.material_triangles[m];
+		}
+		active = chunk.material_names[chunk.current_material];
+	}
+	std::vector<std::string> mesh_name(mesh_size.size());
+	for (std::map<std::string, int>::iterator it = mesh_of_name.begin(); it != mesh_of_name.end(); ++it)
+		mesh_name[it->second] = it->first;
+	for (size_t m = 0; m < mesh_size.size(); m++) {
+		meshes.push_back(obj_make_mesh(materials[mesh_name[m]]));
+		meshes.back().vertices.resize(mesh_size[m]);
+		meshes.back().indices.resize(mesh_size[m]);
+	}
+	for (size_t i = 0; i < threads; i++) {
+		for (size_t m = 0; m < chunks[i].material_mesh.size(); m++)
+			chunks[i].material_mesh[m] += int(first_mesh);
+	}
+
+	// write the triangles in parallel, every chunk owns its own index range
+	workers.clear();
+	for (size_t i = 1; i < threads; i++)
+		workers.push_back(std::thread(obj_write_chunk, std::cref(chunks[i]), std::cref(positions), std::cref(texcoords), std::cref(normals), std::ref(meshes)));
+	obj_write_chunk(chunks[0], positions, texcoords, normals, meshes);
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+
+	// drop materials that ended up without triangles
+	size_t kept = first_mesh;
+	for (size_t m = first_mesh; m < meshes.size(); m++) {
+		if (!meshes[m].indices.empty()) {
+			if (kept != m)
+				std::swap(meshes[kept], meshes[m]);
+			kept++;
+		}
+	}
+	meshes.erase(meshes.begin() + kept, meshes.end());
+	return true;
+}
\ No newline at end of file
@@ -2,8 +2,10 @@
 #include "onb.h"
 #include "random.h"
 
+// value() takes a unit direction, generate() may return any length
 class pdf {
 public:
+	virtual ~pdf() {}
 	virtual float value(const vec3& direction) const = 0;
 	virtual vec3 generate() const = 0;
 };
@@ -42,7 +44,7 @@ private:
 // cosine pdf
 // ----------
 float cosine_pdf::value(const vec3& direction) const {
-	float cosine = dot(unit_vector(direction), uvw.w());
+	float cosine = dot(direction, uvw.w());
 	if (cosine > 0)
 		return cosine / M_PI;
 	else
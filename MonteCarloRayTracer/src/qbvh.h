@@ -0,0 +1,208 @@
+#pragma once
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include "aabb.h"
+#include "ray.h"
+#include "stats.h"
+#include "vec3_simd.h"
+// the integer unpacking needs sse2 and lands in an sse floatx4
+#if defined(VEC3_SSE) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define QBVH_SSE
+#endif
+
+// compressed 4 wide bvh node, one cache line for four children where a binary
+// node spends 36 bytes on one. the children's boxes are 8 bit coordinates on
+// a grid over their union: origin + q * step per axis, with step a power of
+// two. q * step is exact in floats, so the dequantized plane is the same value
+// in the builder and in every traversal, and the builder rounds the low sides
+// down and the high sides up until that value contains the child. a child is
+// a node when its count is 0 and a leaf of count references from child
+// otherwise, the first used children of a node are filled.
+const int qbvh_width = 4;
+const int qbvh_leaf_size = 4;	// binary subtrees this small become one leaf
+const int qbvh_max_leaf = 65535;
+const int qbvh_max_depth = 96;	// binary depth limit plus the splits of oversized leaves
+const int qbvh_stack_size = (qbvh_width - 1) * qbvh_max_depth + 1;
+
+struct qbvh_node {
+	float origin[3];
+	uint8_t exponent[3];	// biased like a float exponent, step = 2^(exponent - 127)
+	uint8_t used;	// children in use
+	uint8_t lo[3][qbvh_width], hi[3][qbvh_width];
+	int32_t child[qbvh_width];	// node index, or first reference of a leaf
+	uint16_t count[qbvh_width];	// references of a leaf, 0 for a node
+};
+static_assert(sizeof(qbvh_node) == 64, "qbvh_node is meant to fill a cache line");
+
+// per ray constants of the slab tests
+struct qbvh_ray {
+	qbvh_ray(const ray& r);
+
+	float origin[3], inverse[3];
+	bool negative[3];	// the high side of the slab is entered first
+};
+
+inline float qbvh_step(uint8_t exponent);
+void qbvh_set_frame(qbvh_node& node, const vec3& lo, const vec3& hi);
+void qbvh_set_child(qbvh_node& node, int slot, const vec3& lo, const vec3& hi, int child, int count);
+aabb qbvh_child_box(const qbvh_node& node, int slot);
+inline int qbvh_intersect(const qbvh_node& node, const qbvh_ray& r, float t_min, float t_max, float t_near[qbvh_width]);
+template <class Leaf> bool qbvh_hit(const qbvh_node* nodes, const ray& r, float t_min, float t_max, const Leaf& leaf);
+
+// build
+// -----
+inline float qbvh_step(uint8_t exponent) {
+	uint32_t bits = uint32_t(exponent) << 23;
+	float step;
+	memcpy(&step, &bits, sizeof(step));
+	return step;
+}
+
+// the grid of a node: the smallest power of two step that spans lo to hi in
+// 255 steps, all slots empty
+void qbvh_set_frame(qbvh_node& node, const vec3& lo, const vec3& hi) {
+	for (int a = 0; a < 3; a++) {
+		int e;
+		frexp(ffmax(hi[a] - lo[a], 0.0f) / 255, &e);
+		e = std::min(std::max(e, -126), 127);
+		while (e < 127 && lo[a] + 255 * qbvh_step(uint8_t(e + 127)) < hi[a])
+			e++;
+		node.origin[a] = lo[a];
+		node.exponent[a] = uint8_t(e + 127);
+	}
+	node.used = 0;
+	memset(node.lo, 255, sizeof(node.lo));
+	memset(node.hi, 0, sizeof(node.hi));
+	for (int i = 0; i < qbvh_width; i++) {
+		node.child[i] = -1;
+		node.count[i] = 0;
+	}
+}
+
+void qbvh_set_child(qbvh_node& node, int slot, const vec3& lo, const vec3& hi, int child, int count) {
+	for (int a = 0; a < 3; a++) {
+		float step = qbvh_step(node.exponent[a]);
+		int qlo = std::min(std::max(int(floor((lo[a] - node.origin[a]) / step)), 0), 255);
+		int qhi = std::min(std::max(int(ceil((hi[a] - node.origin[a]) / step)), 0), 255);
+		while (qlo > 0 && node.origin[a] + qlo * step > lo[a])
+			qlo--;
+		while (qhi < 255 && node.origin[a] + qhi * step < hi[a])
+			qhi++;
+		node.lo[a][slot] = uint8_t(qlo);
+		node.hi[a][slot] = uint8_t(qhi);
+	}
+	node.child[slot] = child;
+	node.count[slot] = uint16_t(count);
+	node.used = uint8_t(std::max(int(node.used), slot + 1));
+}
+
+aabb qbvh_child_box(const qbvh_node& node, int slot) {
+	vec3 lo, hi;
+	for (int a = 0; a < 3; a++) {
+		float step = qbvh_step(node.exponent[a]);
+		lo[a] = node.origin[a] + node.lo[a][slot] * step;
+		hi[a] = node.origin[a] + node.hi[a][slot] * step;
+	}
+	return aabb(lo, hi);
+}
+
+// traversal
+// ---------
+qbvh_ray::qbvh_ray(const ray& r) {
+	for (int a = 0; a < 3; a++) {
+		origin[a] = r.origin()[a];
+		inverse[a] = 1.0f / r.direction()[a];
+		negative[a] = inverse[a] < 0;
+	}
+}
+
+// the four 8 bit coordinates of one axis, dequantized
+inline floatx4 qbvh_plane(const qbvh_node& node, const uint8_t* q, int a) {
+#ifdef QBVH_SSE
+	int32_t packed;
+	memcpy(&packed, q, sizeof(packed));
+	__m128i zero = _mm_setzero_si128();
+	floatx4 quantized(_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero)));
+#else
+	float f[qbvh_width];
+	for (int i = 0; i < qbvh_width; i++)
+		f[i] = q[i];
+	floatx4 quantized = floatx4::load(f);
+#endif
+	return floatx4(node.origin[a]) + quantized * floatx4(qbvh_step(node.exponent[a]));
+}
+
+// one corner of every child box, a lane per child
+inline vec3x4 qbvh_corners(const qbvh_node& node, const uint8_t (*q)[qbvh_width]) {
+	return vec3x4(qbvh_plane(node, q[0], 0), qbvh_plane(node, q[1], 1), qbvh_plane(node, q[2], 2));
+}
+
+// slab test of all four children at once. returns a bit per child the ray
+// enters before t_max and leaves after t_min, with the entry distances in
+// t_near. a plane through the ray origin parallel to it gives 0 * inf, the nan
+// is dropped by the min and max, which keep their second operand.
+inline int qbvh_intersect(const qbvh_node& node, const qbvh_ray& r, float t_min, float t_max, float t_near[qbvh_width]) {
+	vec3x4 lo = qbvh_corners(node, node.lo), hi = qbvh_corners(node, node.hi);
+	vec3x4 entry(r.negative[0] ? hi.x : lo.x, r.negative[1] ? hi.y : lo.y, r.negative[2] ? hi.z : lo.z);
+	vec3x4 exit(r.negative[0] ? lo.x : hi.x, r.negative[1] ? lo.y : hi.y, r.negative[2] ? lo.z : hi.z);
+	vec3x4 origin(vec3(r.origin[0], r.origin[1], r.origin[2]));
+	vec3x4 inverse(vec3(r.inverse[0], r.inverse[1], r.inverse[2]));
+	vec3x4 near_planes = (entry - origin) * inverse, far_planes = (exit - origin) * inverse;
+	floatx4 t0 = max(near_planes.z, max(near_planes.y, max(near_planes.x, floatx4(t_min))));
+	floatx4 t1 = min(far_planes.z, min(far_planes.y, min(far_planes.x, floatx4(t_max))));
+	t0.store(t_near);
+	return (t0 <= t1).mask() & ((1 << node.used) - 1);
+}
+
+// closest hit through the tree rooted at nodes[0]. leaf(first, count, t_min,
+// t_max) tests the references of a leaf, returns whether one was hit and then
+// lowers t_max to the hit. children are visited near to far, and a child
+// entered beyond a hit found meanwhile is skipped when it comes off the stack.
+template <class Leaf> bool qbvh_hit(const qbvh_node* nodes, const ray& r, float t_min, float t_max, const Leaf& leaf) {
+	struct entry {
+		int32_t child;
+		int32_t count;
+		float t;
+	};
+	qbvh_ray q(r);
+	entry stack[qbvh_stack_size];
+	int top = 0;
+	stack[top].child = 0;
+	stack[top].count = 0;
+	stack[top++].t = t_min;
+	bool hit_anything = false;
+	while (top > 0) {
+		entry current = stack[--top];
+		if (current.t > t_max)
+			continue;
+		if (current.count > 0) {
+			if (leaf(current.child, current.count, t_min, t_max))
+				hit_anything = true;
+			continue;
+		}
+		STAT_INC(stat_bvh_nodes);
+		const qbvh_node& node = nodes[current.child];
+		float t_near[qbvh_width];
+		int mask = qbvh_intersect(node, q, t_min, t_max, t_near);
+		// the hit children sorted far to near, so the nearest is popped first
+		int order[qbvh_width];
+		int n = 0;
+		for (int i = 0; i < qbvh_width; i++) {
+			if (!(mask & (1 << i)))
+				continue;
+			int k = n++;
+			for (; k > 0 && t_near[order[k - 1]] < t_near[i]; k--)
+				order[k] = order[k - 1];
+			order[k] = i;
+		}
+		for (int k = 0; k < n; k++) {
+			stack[top].child = node.child[order[k]];
+			stack[top].count = node.count[order[k]];
+			stack[top++].t = t_near[order[k]];
+		}
+	}
+	return hit_anything;
+}
\ No newline at end of file
@@ -1,8 +1,25 @@
 #pragma once
-#include <cstdlib>
+#include <stdint.h>
 
-double random_double() {
-	return rand() / (RAND_MAX + 1.0);
+// pcg32 with one state per thread. the renderer reseeds it for every tile of
+// every pass, so an image depends on the seed but not on the thread count.
+thread_local uint64_t random_state = 0x853c49e6748fea9bull;
+
+inline void seed_random(uint64_t seed) {
+	// splitmix64 spreads nearby seeds over the whole state space
+	seed += 0x9e3779b97f4a7c15ull;
+	seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ull;
+	seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebull;
+	random_state = seed ^ (seed >> 31);
+}
+
+inline double random_double() {
+	uint64_t old = random_state;
+	random_state = old * 6364136223846793005ull + 1442695040888963407ull;
+	uint32_t shifted = uint32_t(((old >> 18) ^ old) >> 27);
+	uint32_t rotation = uint32_t(old >> 59);
+	uint32_t bits = (shifted >> rotation) | (shifted << ((32 - rotation) & 31));
+	return bits * (1.0 / 4294967296.0);
 }
 
 vec3 random_in_unit_disk() {
@@ -1,17 +1,34 @@
 #pragma once
 #include "vec3.h"
 
+// tag for directions the caller knows are unit length already
+struct unit_tag {};
+const unit_tag already_unit = unit_tag();
+
+// spread a ray cone takes after a diffuse bounce, in radians
+const float diffuse_cone_spread = 0.1f;
+
+// direction() is always unit length, so t is a distance and callers never
+// need to normalize it again. every ray also carries a cone, its width at
+// the origin and how fast it grows, which estimates the footprint of a path
+// for texture filtering. the default cone is a line and selects the finest
+// texture level.
 class ray {
 public:
 	ray() {}
-	ray(const vec3& a, const vec3& b, float ti = 0.0) { A = a; B = unit_vector(b); _time = ti; }
+	ray(const vec3& a, const vec3& b, float ti = 0.0) { A = a; B = fast_unit_vector(b); _time = ti; width = 0; spread = 0; }
+	ray(const vec3& a, const vec3& b, float ti, unit_tag) { A = a; B = b; _time = ti; width = 0; spread = 0; }
 	vec3 origin() const { return A; }
 	vec3 direction() const { return B; }
 	float time() const { return _time; }
 	vec3 point_at_parameter(float t) const { return A + t * B; }
+	void set_cone(float w, float s) { width = w; spread = s; }
+	float cone_width(float t) const { return width + spread * t; }
+	float cone_spread() const { return spread; }
 
 private:
 	vec3 A;
 	vec3 B;
 	float _time;
+	float width, spread;
 };
\ No newline at end of file
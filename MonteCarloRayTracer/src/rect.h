@@ -1,6 +1,7 @@
 #pragma once
 #include "hittable.h"
 #include "random.h"
+#include "stats.h"
 
 class xy_rect : public hittable {
 public:
@@ -8,6 +9,8 @@ public:
 	xy_rect(float _x0, float _x1, float _y0, float _y1, float _k, material* mat) : x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(mat) {};
 	virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const override;
 	virtual bool bounding_box(float t0, float t1, aabb& box) const override;
+	virtual float pdf_value(const vec3& o, const vec3& v) const override;
+	virtual vec3 random(const vec3& o) const override;
 
 private:
 	material* mp;
@@ -34,6 +37,8 @@ public:
 	yz_rect(float _y0, float _y1, float _z0, float _z1, float _k, material* mat) : y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
 	virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const override;
 	virtual bool bounding_box(float t0, float t1, aabb& box) const override;
+	virtual float pdf_value(const vec3& o, const vec3& v) const override;
+	virtual vec3 random(const vec3& o) const override;
 
 private:
 	material* mp;
@@ -57,6 +62,7 @@ bool xy_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
 		return false;
 	rec.u = (x - x0) / (x1 - x0);
 	rec.v = (y - y0) / (y1 - y0);
+	rec.uv_scale = 1 / sqrt((x1 - x0) * (y1 - y0));
 	rec.t = t;
 	rec.mat_ptr = mp;
 	rec.p = r.point_at_parameter(t);
@@ -64,6 +70,24 @@ bool xy_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
 	return true;
 }
 
+float xy_rect::pdf_value(const vec3& o, const vec3& v) const {
+	hit_record rec;
+	STAT_INC(stat_shadow_rays);
+	if (this->hit(ray(o, v, 0, already_unit), 0.001, FLT_MAX, rec)) {
+		float area = (x1 - x0) * (y1 - y0);
+		float distance_squared = rec.t * rec.t;
+		float cosine = fabs(dot(v, rec.normal));
+		return  distance_squared / (cosine * area);
+	}
+	else
+		return 0;
+}
+
+vec3 xy_rect::random(const vec3& o) const {
+	vec3 random_point = vec3(x0 + random_double() * (x1 - x0), y0 + random_double() * (y1 - y0), k);
+	return random_point - o;
+}
+
 // xz rectangle
 // ------------
 bool xz_rect::bounding_box(float t0, float t1, aabb& box) const {
@@ -81,6 +105,7 @@ bool xz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
 		return false;
 	rec.u = (x - x0) / (x1 - x0);
 	rec.v = (z - z0) / (z1 - z0);
+	rec.uv_scale = 1 / sqrt((x1 - x0) * (z1 - z0));
 	rec.t = t;
 	rec.mat_ptr = mp;
 	rec.p = r.point_at_parameter(t);
@@ -90,10 +115,11 @@ bool xz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
 
 float xz_rect::pdf_value(const vec3& o, const vec3& v) const {
 	hit_record rec;
-	if (this->hit(ray(o, v), 0.001, FLT_MAX, rec)) {
+	STAT_INC(stat_shadow_rays);
+	if (this->hit(ray(o, v, 0, already_unit), 0.001, FLT_MAX, rec)) {
 		float area = (x1 - x0) * (z1 - z0);
-		float distance_squared = rec.t * rec.t * v.squared_length();
-		float cosine = fabs(dot(v, rec.normal) / v.length());
+		float distance_squared = rec.t * rec.t;
+		float cosine = fabs(dot(v, rec.normal));
 		return  distance_squared / (cosine * area);
 	}
 	else
@@ -122,9 +148,28 @@ bool yz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
 		return false;
 	rec.u = (y - y0) / (y1 - y0);
 	rec.v = (z - z0) / (z1 - z0);
+	rec.uv_scale = 1 / sqrt((y1 - y0) * (z1 - z0));
 	rec.t = t;
 	rec.mat_ptr = mp;
 	rec.p = r.point_at_parameter(t);
 	rec.normal = vec3(1, 0, 0);
 	return true;
+}
+
+float yz_rect::pdf_value(const vec3& o, const vec3& v) const {
+	hit_record rec;
+	STAT_INC(stat_shadow_rays);
+	if (this->hit(ray(o, v, 0, already_unit), 0.001, FLT_MAX, rec)) {
+		float area = (y1 - y0) * (z1 - z0);
+		float distance_squared = rec.t * rec.t;
+		float cosine = fabs(dot(v, rec.normal));
+		return  distance_squared / (cosine * area);
+	}
+	else
+		return 0;
+}
+
+vec3 yz_rect::random(const vec3& o) const {
+	vec3 random_point = vec3(k, y0 + random_double() * (y1 - y0), z0 + random_double() * (z1 - z0));
+	return random_point - o;
 }
\ No newline at end of file
@@ -0,0 +1,188 @@
+#pragma once
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "framebuffer.h"
+#include "vec3.h"
+
+// regression checks against a stored reference render. the reference keeps
+// the mean and the per sample variance of every pixel from a high sample
+// count render of a trusted build. a low sample render is then compared pixel
+// by pixel: the difference of the means divided by its standard error is a z
+// score, near normal if both renders estimate the same image. optimizations
+// that only change the random sequences or the variance stay within the
+// noise, a biased estimator shifts the means and fails.
+//
+// single pixels at low sample counts have heavy tails, so one pixel outside
+// the interval is not a failure. the image fails when more than
+// max_outlier_fraction of the pixels are outside pixel_z, when any square of
+// tile_size pixels, whose mean is close to normal, is outside tile_z, or when
+// the mean of the whole image is outside image_z. the last catches small
+// biases spread over the image that no single tile has the samples to see.
+//
+// the power grows with the samples compared: at 64x64 a 2% brighter cornell
+// box fails at 256 spp and slips through at 64.
+//
+//   render --spp 4096 --width 64 --height 64 --write-reference cornell.ref
+//   render --spp 256 --width 64 --height 64 --seed 1 --compare cornell.ref
+
+struct reference_image {
+	bool read(const std::string& path);
+	bool write(const std::string& path) const;
+
+	int nx, ny, samples;
+	std::vector<vec3> mean, variance;	// rows from the top, variance of one sample
+};
+
+struct reference_test {
+	reference_test() : pixel_z(4), max_outlier_fraction(0.01f), tile_size(8), tile_z(5), image_z(4) {}
+
+	float pixel_z;
+	float max_outlier_fraction;
+	int tile_size;
+	float tile_z;
+	float image_z;
+};
+
+reference_image make_reference(const framebuffer& image);
+bool compare_to_reference(const framebuffer& image, const reference_image& reference, const reference_test& test, std::ostream& report);
+
+// file format
+// -----------
+// "MCRREF1\0", int32 nx, ny, samples, then nx * ny pixels of six floats,
+// mean rgb and variance rgb, little endian as written by x86
+const char reference_magic[8] = { 'M', 'C', 'R', 'R', 'E', 'F', '1', 0 };
+
+reference_image make_reference(const framebuffer& image) {
+	reference_image reference;
+	reference.nx = image.nx;
+	reference.ny = image.ny;
+	reference.samples = image.sample_count();
+	for (int y = 0; y < image.ny; y++) {
+		for (int x = 0; x < image.nx; x++) {
+			reference.mean.push_back(image.mean(x, y));
+			reference.variance.push_back(image.variance(x, y));
+		}
+	}
+	return reference;
+}
+
+bool reference_image::write(const std::string& path) const {
+	FILE* file = fopen(path.c_str(), "wb");
+	if (!file)
+		return false;
+	int32_t header[3] = { nx, ny, samples };
+	bool ok = fwrite(reference_magic, 1, 8, file) == 8 && fwrite(header, sizeof(header), 1, file) == 1;
+	for (size_t i = 0; ok && i < mean.size(); i++) {
+		float pixel[6] = { mean[i][0], mean[i][1], mean[i][2], variance[i][0], variance[i][1], variance[i][2] };
+		ok = fwrite(pixel, sizeof(pixel), 1, file) == 1;
+	}
+	return fclose(file) == 0 && ok;
+}
+
+bool reference_image::read(const std::string& path) {
+	FILE* file = fopen(path.c_str(), "rb");
+	if (!file)
+		return false;
+	char magic[8];
+	int32_t header[3];
+	bool ok = fread(magic, 1, 8, file) == 8 && memcmp(magic, reference_magic, 8) == 0 && fread(header, sizeof(header), 1, file) == 1
+		&& header[0] > 0 && header[1] > 0 && header[2] > 1;
+	if (ok) {
+		nx = header[0];
+		ny = header[1];
+		samples = header[2];
+		mean.resize(size_t(nx) * ny);
+		variance.resize(size_t(nx) * ny);
+	}
+	for (size_t i = 0; ok && i < mean.size(); i++) {
+		float pixel[6];
+		ok = fread(pixel, sizeof(pixel), 1, file) == 1;
+		mean[i] = vec3(pixel[0], pixel[1], pixel[2]);
+		variance[i] = vec3(pixel[3], pixel[4], pixel[5]);
+	}
+	fclose(file);
+	return ok;
+}
+
+// comparison
+// ----------
+// squared standard error of the difference of two means. the larger of the
+// two variances stands in for the render's own, which few samples may
+// underestimate by missing rare bright paths. a small relative floor keeps
+// pixels that never vary, like the background, from dividing by zero.
+inline float reference_error2(float variance, int n, float reference_variance, int reference_n, float m, float reference_m) {
+	float floor = 1e-3f * (fabs(m) + fabs(reference_m)) + 1e-6f;
+	return std::max(variance, reference_variance) / n + reference_variance / reference_n + floor * floor;
+}
+
+bool compare_to_reference(const framebuffer& image, const reference_image& reference, const reference_test& test, std::ostream& report) {
+	if (image.nx != reference.nx || image.ny != reference.ny || image.sample_count() < 2) {
+		report << "reference is " << reference.nx << "x" << reference.ny << ", the render " << image.nx << "x" << image.ny
+			<< " with " << image.sample_count() << " samples, cannot compare" << std::endl;
+		return false;
+	}
+	int n = image.sample_count();
+	int N = reference.samples;
+	int outliers = 0;
+	double worst_pixel = 0, sum = 0, reference_sum = 0;
+	int tiles_x = (image.nx + test.tile_size - 1) / test.tile_size;
+	int tiles_y = (image.ny + test.tile_size - 1) / test.tile_size;
+	int failed_tiles = 0;
+	double worst_tile = 0;
+	vec3 image_difference(0, 0, 0), image_error2(0, 0, 0);
+	for (int ty = 0; ty < tiles_y; ty++) {
+		for (int tx = 0; tx < tiles_x; tx++) {
+			// tile sums of the means and of their squared errors, per channel
+			vec3 difference(0, 0, 0), error2(0, 0, 0);
+			for (int y = ty * test.tile_size; y < std::min((ty + 1) * test.tile_size, image.ny); y++) {
+				for (int x = tx * test.tile_size; x < std::min((tx + 1) * test.tile_size, image.nx); x++) {
+					vec3 m = image.mean(x, y);
+					vec3 v = image.variance(x, y);
+					const vec3& reference_m = reference.mean[y * image.nx + x];
+					const vec3& reference_v = reference.variance[y * image.nx + x];
+					double z = 0;
+					for (int k = 0; k < 3; k++) {
+						float e2 = reference_error2(v[k], n, reference_v[k], N, m[k], reference_m[k]);
+						z = std::max(z, double(fabs(m[k] - reference_m[k]) / sqrt(e2)));
+						difference[k] += m[k] - reference_m[k];
+						error2[k] += e2;
+						sum += m[k];
+						reference_sum += reference_m[k];
+					}
+					worst_pixel = std::max(worst_pixel, z);
+					if (z > test.pixel_z)
+						outliers++;
+				}
+			}
+			image_difference += difference;
+			image_error2 += error2;
+			double z = 0;
+			for (int k = 0; k < 3; k++)
+				z = std::max(z, double(fabs(difference[k]) / sqrt(error2[k])));
+			worst_tile = std::max(worst_tile, z);
+			if (z > test.tile_z) {
+				if (failed_tiles < 10)
+					report << "  tile at " << tx * test.tile_size << "," << ty * test.tile_size << ": z " << z << std::endl;
+				failed_tiles++;
+			}
+		}
+	}
+	double image_z = 0;
+	for (int k = 0; k < 3; k++)
+		image_z = std::max(image_z, double(fabs(image_difference[k]) / sqrt(image_error2[k])));
+	double outlier_fraction = double(outliers) / (image.nx * image.ny);
+	bool pass = outlier_fraction <= test.max_outlier_fraction && failed_tiles == 0 && image_z <= test.image_z;
+	report << "reference comparison " << (pass ? "passed" : "FAILED") << ": " << n << " samples against " << N << std::endl;
+	report << "  pixels outside z " << test.pixel_z << ": " << outliers << " (" << 100 * outlier_fraction << "%, at most "
+		<< 100 * test.max_outlier_fraction << "%), largest z " << worst_pixel << std::endl;
+	report << "  tiles outside z " << test.tile_z << ": " << failed_tiles << " of " << tiles_x * tiles_y << ", largest z " << worst_tile << std::endl;
+	report << "  image mean " << sum / (3.0 * image.nx * image.ny) << ", reference " << reference_sum / (3.0 * image.nx * image.ny)
+		<< ", z " << image_z << " (at most " << test.image_z << ")" << std::endl;
+	return pass;
+}
\ No newline at end of file
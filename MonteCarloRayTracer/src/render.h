@@ -0,0 +1,153 @@
+#pragma once
+#include <float.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "aov.h"
+#include "camera.h"
+#include "environment.h"
+#include "framebuffer.h"
+#include "heatmap.h"
+#include "hittable.h"
+#include "material.h"
+#include "pdf.h"
+#include "random.h"
+#include "settings.h"
+#include "stats.h"
+#include "trace.h"
+
+// the path tracing integrator and the pass loop around it, shared by the
+// renderer and the benchmark
+
+inline vec3 de_nan(const vec3& c) {
+	vec3 temp = c;
+	if (!(temp[0] == temp[0] && temp[1] == temp[1] && temp[2] == temp[2]))
+		STAT_INC(stat_nans);
+	if (!(temp[0] == temp[0])) temp[0] = 0;
+	if (!(temp[1] == temp[1])) temp[1] = 0;
+	if (!(temp[2] == temp[2])) temp[2] = 0;
+	return temp;
+}
+
+inline vec3 clamp_albedo(const vec3& c) {
+	return vec3(ffmin(c[0], 1.0f), ffmin(c[1], 1.0f), ffmin(c[2], 1.0f));
+}
+
+// light_shape and environment are sampled alongside the material, either may
+// be 0. aov, when given, receives the first hit of the path.
+vec3 color(const ray& r, hittable* scene, hittable* light_shape, environment_map* environment, int depth, int max_depth, aov_sample* aov = 0) {
+	hit_record hrec;
+	if (scene->hit(r, 0.001, FLT_MAX, hrec)) {
+		float width = r.cone_width(hrec.t);
+		hrec.uv_width = width * hrec.uv_scale;
+		vec3 emitted = material_emitted(hrec.mat_ptr, r, hrec, hrec.u, hrec.v, hrec.p);
+		if (aov) {
+			aov->albedo = clamp_albedo(emitted);
+			aov->normal = hrec.normal;
+			aov->depth = hrec.t * r.direction().length();
+		}
+
+		scatter_record srec;
+		if (depth < max_depth && material_scatter(hrec.mat_ptr, r, hrec, srec)) {
+			if (aov)
+				aov->albedo = srec.attenuation;
+			if (srec.is_specular) {
+				STAT_INC(stat_secondary_rays);
+				srec.specular_ray.set_cone(width, r.cone_spread());
+				return srec.attenuation * color(srec.specular_ray, scene, light_shape, environment, depth + 1, max_depth);
+			}
+			else {
+				hittable_pdf plight(light_shape, hrec.p);
+				environment_pdf penvironment(environment);
+				mixture_pdf plights(&plight, &penvironment);
+				pdf* light_pdf = srec.pdf_ptr;
+				if (light_shape && environment)
+					light_pdf = &plights;
+				else if (light_shape)
+					light_pdf = &plight;
+				else if (environment)
+					light_pdf = &penvironment;
+				mixture_pdf p(light_pdf, srec.pdf_ptr);
+				ray scattered = ray(hrec.p, p.generate(), r.time());
+				scattered.set_cone(width, ffmax(r.cone_spread(), diffuse_cone_spread));
+				float pdf_val = p.value(scattered.direction());
+				STAT_INC(stat_secondary_rays);
+				delete srec.pdf_ptr;
+				return emitted
+					+ srec.attenuation * material_scattering_pdf(hrec.mat_ptr, r, hrec, scattered)
+					* color(scattered, scene, light_shape, environment, depth + 1, max_depth)
+					/ pdf_val;
+			}
+		}
+		else {
+			STAT_PATH(depth + 1);
+			return emitted;
+		}
+	}
+	STAT_PATH(depth);
+	if (environment) {
+		vec3 background = environment->value(r.direction());
+		if (aov)
+			aov->albedo = clamp_albedo(background);
+		return background;
+	}
+	else
+		return vec3(0, 0, 0);
+}
+
+const int render_tile_size = 32;
+
+// adds one sample to every pixel. threads take square tiles one at a time and
+// every tile reseeds the generator, so the image depends on the seed and not
+// on the thread count or scheduling. costs and aovs may be 0, tiles never
+// overlap so threads write their pixels without locking.
+void render_pass(camera* cam, hittable* scene, hittable* light_shape, environment_map* environment,
+	const render_settings& settings, int pass, framebuffer& image, cost_buffer* costs, aov_buffer* aovs) {
+	int tiles_x = (image.nx + render_tile_size - 1) / render_tile_size;
+	int tiles_y = (image.ny + render_tile_size - 1) / render_tile_size;
+	int tiles = tiles_x * tiles_y;
+	std::atomic<int> next(0);
+	auto work = [&](bool worker) {
+		for (int tile = next++; tile < tiles; tile = next++) {
+			TRACE_SCOPE("tile", "pass", pass, "tile", tile);
+			seed_random(settings.seed * 0x9e3779b97f4a7c15ull + uint64_t(pass) * tiles + tile);
+			int x0 = tile % tiles_x * render_tile_size;
+			int y0 = tile / tiles_x * render_tile_size;
+			int x1 = std::min(x0 + render_tile_size, image.nx);
+			int y1 = std::min(y0 + render_tile_size, image.ny);
+			for (int y = y0; y < y1; y++) {
+				int j = image.ny - 1 - y;
+				for (int i = x0; i < x1; i++) {
+					uint64_t ticks = costs ? cost_clock() : 0;
+					uint64_t nodes = cost_steps();
+					float u = float(i + random_double()) / float(image.nx);
+					float v = float(j + random_double()) / float(image.ny);
+					ray r = cam->get_ray(u, v);
+					STAT_INC(stat_camera_rays);
+					aov_sample first;
+					image.add(i, y, de_nan(color(r, scene, light_shape, environment, 0, settings.max_depth, aovs ? &first : 0)));
+					if (aovs)
+						aovs->add(i, y, first);
+					if (costs)
+						costs->add(i, y, cost_clock() - ticks, cost_steps() - nodes);
+				}
+			}
+		}
+		flush_stats();
+		// the calling thread keeps its trace track across passes
+		if (worker)
+			trace_release();
+	};
+	std::vector<std::thread> workers;
+	for (int t = 1; t < settings.threads; t++)
+		workers.push_back(std::thread(work, true));
+	work(false);
+	for (size_t t = 0; t < workers.size(); t++)
+		workers[t].join();
+	image.finish_pass(1);
+	if (costs)
+		costs->finish_pass(1);
+	if (aovs)
+		aovs->finish_pass(1);
+}
\ No newline at end of file
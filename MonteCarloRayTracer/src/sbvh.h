@@ -0,0 +1,509 @@
+#pragma once
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "qbvh.h"
+#include "stats.h"
+#include "triangle.h"
+
+// spatial split bvh (Stich et al. 2009). besides the usual object splits a node
+// may be split by a plane, duplicating the references of the triangles that
+// straddle it. this keeps long, thin triangles from inflating every node above
+// them. memory_budget caps the number of references at memory_budget * n, a
+// budget of 1 disables spatial splits and gives a plain SAH object split bvh.
+// the tree is built binary, compress() then turns it into the quantized 4 wide
+// layout of qbvh.h for rendering.
+const int sbvh_bins = 32;
+const int sbvh_max_leaf = 4;
+const int sbvh_max_depth = 64;
+const float sbvh_traversal_cost = 1.0f;
+const float sbvh_intersect_cost = 1.0f;
+
+struct material_description;
+
+class sbvh : public hittable {
+public:
+	sbvh() : triangles(0), num_triangles(0) {}
+	sbvh(Triangle** l, int n, float memory_budget = 1.5f, float alpha = 1e-5f);
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+	virtual bool bounding_box(float t0, float t1, aabb& box) const override;
+	void compress();
+	bool compressed() const { return !wide.empty(); }
+	float sah_cost() const;	// of the binary tree, 0 once compressed
+	size_t node_memory() const;
+	size_t memory_usage() const;
+	int triangle_count() const { return num_triangles; }
+	int reference_count() const { return int(refs.size()); }
+	int node_count() const { return int(compressed() ? wide.size() : nodes.size()); }
+
+	friend bool write_bvh_cache(const std::string& path, unsigned long long key, const sbvh& tree, Triangle** l, int n,
+		const int* material_of, const std::vector<material_description>& materials);
+
+private:
+	struct node {
+		aabb box;
+		int offset;	// first reference of a leaf, right child of an inner node
+		int count;	// number of references, 0 for inner nodes
+		int axis;
+	};
+
+	struct reference {
+		vec3 lo, hi;
+		int index;
+	};
+
+	int build(std::vector<reference>& list, int depth);
+	void split_reference(const reference& ref, int axis, float pos, reference& left, reference& right) const;
+	int collapse(int index, const std::vector<int>& subtree_first, const std::vector<int>& subtree_count);
+	int collapse_leaf(const aabb& box, int first, int count);
+
+	std::vector<node> nodes;	// binary, freed by compress()
+	std::vector<qbvh_node> wide;
+	aabb bounds;
+	std::vector<Triangle*> refs;
+	Triangle** triangles;
+	int num_triangles;
+	int max_references;
+	int total_references;
+	float alpha;
+	float root_area;
+};
+
+// box helpers
+// -----------
+inline void sbvh_empty(vec3& lo, vec3& hi) {
+	lo = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+	hi = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+}
+
+inline void sbvh_grow(vec3& lo, vec3& hi, const vec3& plo, const vec3& phi) {
+	for (int a = 0; a < 3; a++) {
+		lo[a] = ffmin(lo[a], plo[a]);
+		hi[a] = ffmax(hi[a], phi[a]);
+	}
+}
+
+inline float sbvh_area(const vec3& lo, const vec3& hi) {
+	vec3 d = hi - lo;
+	if (d.x() < 0 || d.y() < 0 || d.z() < 0)
+		return 0;
+	return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+}
+
+// sbvh
+// ----
+sbvh::sbvh(Triangle** l, int n, float memory_budget, float alpha) : alpha(alpha) {
+	triangles = l;
+	num_triangles = n;
+	max_references = int(n * ffmax(memory_budget, 1.0f));
+	total_references = n;
+	std::vector<reference> list(n);
+	vec3 lo, hi;
+	sbvh_empty(lo, hi);
+	for (int i = 0; i < n; i++) {
+		aabb b;
+		l[i]->bounding_box(0, 1, b);
+		list[i].lo = b.min();
+		list[i].hi = b.max();
+		list[i].index = i;
+		sbvh_grow(lo, hi, b.min(), b.max());
+	}
+	root_area = sbvh_area(lo, hi);
+	if (n > 0) {
+		build(list, 0);
+		bounds = nodes[0].box;
+	}
+}
+
+int sbvh::build(std::vector<reference>& list, int depth) {
+	int index = int(nodes.size());
+	nodes.push_back(node());
+	int n = int(list.size());
+	vec3 lo, hi;
+	sbvh_empty(lo, hi);
+	for (int i = 0; i < n; i++)
+		sbvh_grow(lo, hi, list[i].lo, list[i].hi);
+	float area = sbvh_area(lo, hi);
+	float leaf_cost = n * sbvh_intersect_cost;
+
+	// object split: sah sweep over the references sorted by centroid
+	float object_cost = FLT_MAX;
+	int object_axis = 0, object_split = 1;
+	vec3 object_llo, object_lhi, object_rlo, object_rhi;
+	std::vector<int> order(n);
+	std::vector<float> right_area(n);
+	for (int axis = 0; axis < 3 && n > 1; axis++) {
+		for (int i = 0; i < n; i++)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), [&](int a, int b) {
+			return list[a].lo[axis] + list[a].hi[axis] < list[b].lo[axis] + list[b].hi[axis];
+		});
+		vec3 rlo, rhi;
+		sbvh_empty(rlo, rhi);
+		for (int i = n - 1; i > 0; i--) {
+			sbvh_grow(rlo, rhi, list[order[i]].lo, list[order[i]].hi);
+			right_area[i] = sbvh_area(rlo, rhi);
+		}
+		vec3 llo, lhi;
+		sbvh_empty(llo, lhi);
+		for (int i = 1; i < n; i++) {
+			sbvh_grow(llo, lhi, list[order[i - 1]].lo, list[order[i - 1]].hi);
+			float cost = sbvh_area(llo, lhi) * i + right_area[i] * (n - i);
+			if (cost < object_cost) {
+				object_cost = cost;
+				object_axis = axis;
+				object_split = i;
+			}
+		}
+	}
+	if (n > 1) {
+		for (int i = 0; i < n; i++)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), [&](int a, int b) {
+			return list[a].lo[object_axis] + list[a].hi[object_axis] < list[b].lo[object_axis] + list[b].hi[object_axis];
+		});
+		sbvh_empty(object_llo, object_lhi);
+		sbvh_empty(object_rlo, object_rhi);
+		for (int i = 0; i < n; i++) {
+			if (i < object_split)
+				sbvh_grow(object_llo, object_lhi, list[order[i]].lo, list[order[i]].hi);
+			else
+				sbvh_grow(object_rlo, object_rhi, list[order[i]].lo, list[order[i]].hi);
+		}
+	}
+
+	// spatial split: only worth trying when the object split children overlap
+	float spatial_cost = FLT_MAX;
+	int spatial_axis = 0;
+	float spatial_pos = 0;
+	vec3 overlap_lo, overlap_hi;
+	sbvh_empty(overlap_lo, overlap_hi);
+	if (n > 1) {
+		for (int a = 0; a < 3; a++) {
+			overlap_lo[a] = ffmax(object_llo[a], object_rlo[a]);
+			overlap_hi[a] = ffmin(object_lhi[a], object_rhi[a]);
+		}
+	}
+	bool try_spatial = n > 1 && depth < sbvh_max_depth && total_references < max_references
+		&& sbvh_area(overlap_lo, overlap_hi) > alpha * root_area;
+	for (int axis = 0; axis < 3 && try_spatial; axis++) {
+		float extent = hi[axis] - lo[axis];
+		if (extent <= 0)
+			continue;
+		float width = extent / sbvh_bins;
+		vec3 bin_lo[sbvh_bins], bin_hi[sbvh_bins];
+		int enter[sbvh_bins] = { 0 }, exit[sbvh_bins] = { 0 };
+		for (int b = 0; b < sbvh_bins; b++)
+			sbvh_empty(bin_lo[b], bin_hi[b]);
+		for (int i = 0; i < n; i++) {
+			int first = std::min(std::max(int((list[i].lo[axis] - lo[axis]) / width), 0), sbvh_bins - 1);
+			int last = std::min(std::max(int((list[i].hi[axis] - lo[axis]) / width), first), sbvh_bins - 1);
+			reference current = list[i];
+			for (int b = first; b < last; b++) {
+				reference left, right;
+				split_reference(current, axis, lo[axis] + width * (b + 1), left, right);
+				sbvh_grow(bin_lo[b], bin_hi[b], left.lo, left.hi);
+				current = right;
+			}
+			sbvh_grow(bin_lo[last], bin_hi[last], current.lo, current.hi);
+			enter[first]++;
+			exit[last]++;
+		}
+		vec3 rlo, rhi;
+		sbvh_empty(rlo, rhi);
+		float bin_right_area[sbvh_bins];
+		int bin_right_count[sbvh_bins];
+		int count = 0;
+		for (int b = sbvh_bins - 1; b > 0; b--) {
+			sbvh_grow(rlo, rhi, bin_lo[b], bin_hi[b]);
+			count += exit[b];
+			bin_right_area[b] = sbvh_area(rlo, rhi);
+			bin_right_count[b] = count;
+		}
+		vec3 llo, lhi;
+		sbvh_empty(llo, lhi);
+		count = 0;
+		for (int b = 1; b < sbvh_bins; b++) {
+			sbvh_grow(llo, lhi, bin_lo[b - 1], bin_hi[b - 1]);
+			count += enter[b - 1];
+			if (count == 0 || bin_right_count[b] == 0)
+				continue;
+			float cost = sbvh_area(llo, lhi) * count + bin_right_area[b] * bin_right_count[b];
+			if (cost < spatial_cost) {
+				spatial_cost = cost;
+				spatial_axis = axis;
+				spatial_pos = lo[axis] + width * b;
+			}
+		}
+	}
+
+	float split_cost = sbvh_traversal_cost + ffmin(object_cost, spatial_cost) / ffmax(area, 1e-20f) * sbvh_intersect_cost;
+	bool make_leaf = n <= 1 || depth >= sbvh_max_depth
+		|| (n <= sbvh_max_leaf && split_cost >= leaf_cost);
+
+	std::vector<reference> left, right;
+	int axis = object_axis;
+	if (!make_leaf && spatial_cost < object_cost) {
+		for (int i = 0; i < n; i++) {
+			if (list[i].hi[spatial_axis] <= spatial_pos)
+				left.push_back(list[i]);
+			else if (list[i].lo[spatial_axis] >= spatial_pos)
+				right.push_back(list[i]);
+			else {
+				reference l, r;
+				split_reference(list[i], spatial_axis, spatial_pos, l, r);
+				left.push_back(l);
+				right.push_back(r);
+			}
+		}
+		int duplicates = int(left.size() + right.size()) - n;
+		if (left.empty() || right.empty() || total_references + duplicates > max_references) {
+			left.clear();
+			right.clear();
+		}
+		else {
+			total_references += duplicates;
+			axis = spatial_axis;
+		}
+	}
+	if (!make_leaf && left.empty()) {
+		for (int i = 0; i < n; i++) {
+			if (i < object_split)
+				left.push_back(list[order[i]]);
+			else
+				right.push_back(list[order[i]]);
+		}
+	}
+
+	if (make_leaf) {
+		nodes[index].box = padded_box(lo, hi);
+		nodes[index].offset = int(refs.size());
+		nodes[index].count = n;
+		nodes[index].axis = 0;
+		for (int i = 0; i < n; i++)
+			refs.push_back(triangles[list[i].index]);
+		return index;
+	}
+
+	std::vector<reference>().swap(list);
+	build(left, depth + 1);
+	int right_child = build(right, depth + 1);
+	nodes[index].box = padded_box(lo, hi);
+	nodes[index].offset = right_child;
+	nodes[index].count = 0;
+	nodes[index].axis = axis;
+	return index;
+}
+
+// clip the triangle behind ref against the plane and bound both halves
+void sbvh::split_reference(const reference& ref, int axis, float pos, reference& left, reference& right) const {
+	sbvh_empty(left.lo, left.hi);
+	sbvh_empty(right.lo, right.hi);
+	left.index = right.index = ref.index;
+	const Triangle* tri = triangles[ref.index];
+	const vec3* v[3] = { &tri->v0, &tri->v1, &tri->v2 };
+	for (int i = 0; i < 3; i++) {
+		const vec3& a = *v[i];
+		const vec3& b = *v[(i + 1) % 3];
+		float pa = a[axis], pb = b[axis];
+		if (pa <= pos)
+			sbvh_grow(left.lo, left.hi, a, a);
+		if (pa >= pos)
+			sbvh_grow(right.lo, right.hi, a, a);
+		if ((pa < pos && pb > pos) || (pa > pos && pb < pos)) {
+			vec3 x = a + (b - a) * ffmin(ffmax((pos - pa) / (pb - pa), 0.0f), 1.0f);
+			x[axis] = pos;
+			sbvh_grow(left.lo, left.hi, x, x);
+			sbvh_grow(right.lo, right.hi, x, x);
+		}
+	}
+	left.hi[axis] = pos;
+	right.lo[axis] = pos;
+	for (int a = 0; a < 3; a++) {
+		left.lo[a] = ffmax(left.lo[a], ref.lo[a]);
+		left.hi[a] = ffmin(left.hi[a], ref.hi[a]);
+		right.lo[a] = ffmax(right.lo[a], ref.lo[a]);
+		right.hi[a] = ffmin(right.hi[a], ref.hi[a]);
+	}
+}
+
+// compress
+// --------
+void sbvh::compress() {
+	if (nodes.empty() || compressed())
+		return;
+	// the references below a node are contiguous, children follow parents
+	std::vector<int> first(nodes.size()), count(nodes.size());
+	for (int i = int(nodes.size()) - 1; i >= 0; i--) {
+		first[i] = nodes[i].count > 0 ? nodes[i].offset : first[i + 1];
+		count[i] = nodes[i].count > 0 ? nodes[i].count : count[i + 1] + count[nodes[i].offset];
+	}
+	wide.reserve(nodes.size() / 3 + 1);
+	collapse(0, first, count);
+	std::vector<node>().swap(nodes);
+}
+
+// a wide node over up to four descendants of index: the inner child with the
+// largest surface area is opened until there are four or only leaves are
+// left. subtrees of at most qbvh_leaf_size references count as leaves, which
+// fills the nodes whose binary children are small leaves.
+int sbvh::collapse(int index, const std::vector<int>& subtree_first, const std::vector<int>& subtree_count) {
+	int children[qbvh_width] = { index };
+	int n = 1;
+	while (n < qbvh_width) {
+		int best = -1;
+		float best_area = -1;
+		for (int i = 0; i < n; i++) {
+			bool leaf = nodes[children[i]].count > 0 || (children[i] != index && subtree_count[children[i]] <= qbvh_leaf_size);
+			if (!leaf && nodes[children[i]].box.area() > best_area) {
+				best = i;
+				best_area = nodes[children[i]].box.area();
+			}
+		}
+		if (best < 0)
+			break;
+		int inner = children[best];
+		children[best] = inner + 1;
+		children[n++] = nodes[inner].offset;
+	}
+	vec3 lo, hi;
+	sbvh_empty(lo, hi);
+	for (int i = 0; i < n; i++)
+		sbvh_grow(lo, hi, nodes[children[i]].box.min(), nodes[children[i]].box.max());
+	int index_wide = int(wide.size());
+	wide.push_back(qbvh_node());
+	qbvh_set_frame(wide[index_wide], lo, hi);
+	for (int i = 0; i < n; i++) {
+		const node& current = nodes[children[i]];
+		int child = subtree_first[children[i]], count = subtree_count[children[i]];
+		if (current.count == 0 && count > qbvh_leaf_size) {
+			child = collapse(children[i], subtree_first, subtree_count);
+			count = 0;
+		}
+		else if (count > qbvh_max_leaf) {
+			child = collapse_leaf(current.box, child, count);
+			count = 0;
+		}
+		qbvh_set_child(wide[index_wide], i, current.box.min(), current.box.max(), child, count);
+	}
+	return index_wide;
+}
+
+// leaves over the 16 bit count, only possible at the depth limit, become
+// nodes over slices of their references that all share the leaf's box
+int sbvh::collapse_leaf(const aabb& box, int first, int count) {
+	int index_wide = int(wide.size());
+	wide.push_back(qbvh_node());
+	qbvh_set_frame(wide[index_wide], box.min(), box.max());
+	int slice = (count + qbvh_width - 1) / qbvh_width;
+	for (int i = 0; i < qbvh_width && count > 0; i++) {
+		int n = std::min(slice, count);
+		int child = first, leaf_count = n;
+		if (n > qbvh_max_leaf) {
+			child = collapse_leaf(box, first, n);
+			leaf_count = 0;
+		}
+		qbvh_set_child(wide[index_wide], i, box.min(), box.max(), child, leaf_count);
+		first += n;
+		count -= n;
+	}
+	return index_wide;
+}
+
+// traversal
+// ---------
+// only the closest triangle decodes its attributes into rec
+bool sbvh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+	const Triangle* closest = 0;
+	float closest_u = 0, closest_v = 0;
+	if (compressed()) {
+		float closest_t = t_max;
+		qbvh_hit(wide.data(), r, t_min, t_max, [&](int first, int count, float t_min, float& t_max) {
+			bool hit_anything = false;
+			for (int i = first; i < first + count; i++) {
+				float t, u, v;
+				if (refs[i]->intersect(r, t_min, t_max, t, u, v)) {
+					hit_anything = true;
+					t_max = closest_t = t;
+					closest = refs[i];
+					closest_u = u;
+					closest_v = v;
+				}
+			}
+			return hit_anything;
+		});
+		if (!closest)
+			return false;
+		closest->shade(r, closest_t, closest_u, closest_v, rec);
+		return true;
+	}
+	if (nodes.empty())
+		return false;
+	int stack[sbvh_max_depth + 2];
+	int top = 0;
+	stack[top++] = 0;
+	float closest_so_far = t_max;
+	while (top > 0) {
+		const node& current = nodes[stack[--top]];
+		STAT_INC(stat_bvh_nodes);
+		if (!current.box.hit(r, t_min, closest_so_far))
+			continue;
+		if (current.count > 0) {
+			for (int i = current.offset; i < current.offset + current.count; i++) {
+				float t, u, v;
+				if (refs[i]->intersect(r, t_min, closest_so_far, t, u, v)) {
+					closest_so_far = t;
+					closest = refs[i];
+					closest_u = u;
+					closest_v = v;
+				}
+			}
+		}
+		else {
+			int left = int(&current - &nodes[0]) + 1;
+			if (r.direction()[current.axis] < 0) {
+				stack[top++] = left;
+				stack[top++] = current.offset;
+			}
+			else {
+				stack[top++] = current.offset;
+				stack[top++] = left;
+			}
+		}
+	}
+	if (!closest)
+		return false;
+	closest->shade(r, closest_so_far, closest_u, closest_v, rec);
+	return true;
+}
+
+bool sbvh::bounding_box(float t0, float t1, aabb& box) const {
+	if (num_triangles == 0)
+		return false;
+	box = bounds;
+	return true;
+}
+
+// expected cost of a random ray under the surface area heuristic
+float sbvh::sah_cost() const {
+	if (nodes.empty())
+		return 0;
+	float cost = 0;
+	float root = ffmax(nodes[0].box.area(), 1e-20f);
+	for (size_t i = 0; i < nodes.size(); i++) {
+		float p = nodes[i].box.area() / root;
+		if (nodes[i].count > 0)
+			cost += p * nodes[i].count * sbvh_intersect_cost;
+		else
+			cost += p * sbvh_traversal_cost;
+	}
+	return cost;
+}
+
+size_t sbvh::node_memory() const {
+	return nodes.size() * sizeof(node) + wide.size() * sizeof(qbvh_node);
+}
+
+size_t sbvh::memory_usage() const {
+	return node_memory() + refs.size() * sizeof(Triangle*);
+}
\ No newline at end of file
@@ -0,0 +1,535 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "arena.h"
+#include "box.h"
+#include "bvh_cache.h"
+#include "camera.h"
+#include "environment.h"
+#include "hittable_bvh.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "material.h"
+#include "material_table.h"
+#include "model.h"
+#include "rect.h"
+#include "sbvh.h"
+#include "sphere.h"
+#include "stats.h"
+#include "texture.h"
+#include "texture_cache.h"
+#include "trace.h"
+#include "transform.h"
+
+// a scene file is plain text, one statement per line and # for comments,
+// in the spirit of obj and mtl. paths are relative to the scene file.
+//
+//   resolution nx ny
+//   samples ns
+//   camera from.xyz at.xyz up.xyz vfov aperture focus_dist [time0 time1]
+//   texture name constant r g b
+//   texture name image path [linear]
+//   texture name tiled path [linear]    (read from disk in tiles as needed)
+//   texture_cache megabytes             (budget of the tiles, before any tiled texture)
+//   material name lambertian texture|r g b
+//   material name metal r g b fuzz
+//   material name dielectric ri
+//   material name diffuse_light texture|r g b
+//   sphere cx cy cz radius material
+//   xy_rect x0 x1 y0 y1 k material      (xz_rect, yz_rect alike)
+//   box x0 y0 z0 x1 y1 z1 material
+//   mesh path material|mtl [sbvh]
+//   light xz_rect x0 x1 z0 z1 k         (sampled for direct light, also
+//                                        xy_rect, yz_rect and sphere cx cy cz radius)
+//   environment path [intensity]
+//
+// primitives and meshes may end in modifiers applied left to right:
+// flip, scale s|sx sy sz, rotate_x|rotate_y|rotate_z degrees, translate x y z.
+// every mesh file is imported once per tree type, on its own thread, and its
+// copies become instances of one bvh, each with its own material.
+struct scene_view {
+	vec3 lookfrom, lookat, vup;
+	float vfov, aperture, focus_dist, time0, time1;
+};
+
+// everything the scene creates lives in its arena and goes with it, apart
+// from image textures, which a library shares across scenes
+struct scene {
+	scene();
+	camera* make_camera() const;
+
+	arena memory;
+	hittable* world;
+	hittable* light_shape;	// 0 if nothing is sampled explicitly
+	environment_map* environment;	// 0 for a black background
+	texture_cache* tiles;	// 0 until a tiled texture is loaded
+	int tile_budget;	// megabytes
+	scene_view view;
+	int nx, ny, ns;
+};
+
+bool load_scene(const std::string& path, scene& s);
+
+// model import
+// ------------
+// with mat set the whole model uses it, otherwise every mesh gets the
+// material described by its MTL entry. the materials go into memory, the
+// tree and its triangles only when no cache could be written.
+hittable* import_model(string path, material* mat, bool spatial_splits, texture_library& textures, arena& memory) {
+	// map the tree written by an earlier run instead of importing and rebuilding
+	string cache_path = bvh_cache_path(path, spatial_splits);
+	unsigned long long key = bvh_cache_key(path, spatial_splits);
+	mapped_mesh* cached;
+	{
+		TRACE_SCOPE("map bvh cache", cache_path);
+		cached = load_bvh_cache(cache_path, key, mat, textures, memory);
+	}
+	if (cached)
+		return cached;
+
+	TRACE_SCOPE("import", path);
+	Model model(path);
+	vector<material_description> descriptions;
+	material_table materials;
+	size_t count = 0;
+	for (unsigned int i = 0; i < model.meshes.size(); i++)
+		count += model.meshes[i].indices.size() / 3;
+	if (count == 0)
+		return 0;
+	// the triangles sit side by side in an arena of their own, which the tree
+	// shares. both are dropped once the cache maps.
+	arena* build_memory = new arena();
+	Triangle* storage = build_memory->allocate_array<Triangle>(count);
+	vector<Triangle*> triangles;
+	vector<int> material_of;
+	triangles.reserve(count);
+	material_of.reserve(count);
+	for (unsigned int i = 0; i < model.meshes.size(); i++) {
+		const Mesh& mesh = model.meshes[i];
+		material_description description(mesh);
+		int index = int(find(descriptions.begin(), descriptions.end(), description) - descriptions.begin());
+		if (index == int(descriptions.size())) {
+			descriptions.push_back(description);
+			materials.push_back(mat ? mat : make_material(description, textures, memory));
+		}
+		for (unsigned int j = 0; j + 2 < mesh.indices.size(); j += 3) {
+			Triangle* triangle = new (storage + triangles.size()) Triangle(
+				mesh.vertices[mesh.indices[j]],
+				mesh.vertices[mesh.indices[j + 1]],
+				mesh.vertices[mesh.indices[j + 2]],
+				materials[index]
+			);
+			triangles.push_back(triangle);
+			material_of.push_back(index);
+		}
+	}
+	build_memory->own_array(storage, triangles.size());
+	sbvh* tree;
+	{
+		TRACE_SCOPE("build sbvh", path);
+		tree = build_memory->make<sbvh>(triangles.data(), int(triangles.size()), spatial_splits ? 1.5f : 1.0f);
+	}
+	{
+		TRACE_SCOPE("compress sbvh", path);
+		tree->compress();
+	}
+	TRACE_SCOPE("write bvh cache", cache_path);
+	if (write_bvh_cache(cache_path, key, *tree, triangles.data(), triangles.size(), material_of.data(), descriptions))
+		cached = load_bvh_cache(cache_path, key, mat, textures, memory);
+	if (!cached) {
+		memory.adopt(build_memory);
+		return tree;
+	}
+	delete build_memory;
+	return cached;
+}
+
+// scene
+// -----
+scene::scene() : world(0), light_shape(0), environment(0), tiles(0), tile_budget(64), nx(500), ny(500), ns(100) {
+	view.lookfrom = vec3(0, 0, 0);
+	view.lookat = vec3(0, 0, -1);
+	view.vup = vec3(0, 1, 0);
+	view.vfov = 40;
+	view.aperture = 0;
+	view.focus_dist = 10;
+	view.time0 = 0;
+	view.time1 = 1;
+}
+
+camera* scene::make_camera() const {
+	camera* cam = new camera(view.lookfrom, view.lookat, view.vup, view.vfov, float(nx) / float(ny), view.aperture, view.focus_dist, view.time0, view.time1);
+	cam->set_image_height(ny);
+	return cam;
+}
+
+// scene loader
+// ------------
+struct scene_mesh_job {
+	std::string path;
+	material* mat;	// imported with, 0 for the mtl materials
+	bool spatial_splits;
+	bool uses_mtl;	// some instance keeps the mtl materials
+	hittable* result;
+	double seconds;
+	arena* memory;	// one per job, the jobs build in parallel
+};
+
+struct scene_mesh_instance {
+	int job;
+	material* mat;	// 0 for the mtl materials
+	affine to_world;
+	bool flip;
+};
+
+inline double scene_seconds(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline bool scene_read(std::istringstream& in, vec3& v) {
+	return bool(in >> v[0] >> v[1] >> v[2]);
+}
+
+inline std::string scene_resolve(const std::string& directory, const std::string& path) {
+	if (path.empty() || path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':'))
+		return path;
+	return directory + path;
+}
+
+// reads the trailing modifiers of a primitive, false on an unknown word
+bool scene_read_modifiers(std::istringstream& in, affine& to_world, bool& transformed, bool& flip) {
+	std::string word;
+	while (in >> word) {
+		affine step;
+		if (word == "flip") {
+			flip = !flip;
+			continue;
+		}
+		else if (word == "translate") {
+			vec3 offset;
+			if (!scene_read(in, offset))
+				return false;
+			step = affine::translation(offset);
+		}
+		else if (word == "scale") {
+			float s;
+			if (!(in >> s))
+				return false;
+			vec3 factor(s, s, s);
+			float sy, sz;
+			std::streampos at = in.tellg();
+			if (in >> sy >> sz)
+				factor = vec3(s, sy, sz);
+			else {
+				in.clear();
+				in.seekg(at);
+			}
+			step = affine::scaling(factor);
+		}
+		else if (word == "rotate_x" || word == "rotate_y" || word == "rotate_z") {
+			float angle;
+			if (!(in >> angle))
+				return false;
+			vec3 axis(word == "rotate_x", word == "rotate_y", word == "rotate_z");
+			step = affine::rotation(axis, angle);
+		}
+		else
+			return false;
+		to_world = step * to_world;
+		transformed = true;
+	}
+	return true;
+}
+
+bool load_scene(const std::string& path, scene& s) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	phase_timer load_phase(phase_load);
+	TRACE_SCOPE("load scene", path);
+	std::ifstream file(path);
+	if (!file) {
+		std::cerr << "cannot open scene " << path << std::endl;
+		return false;
+	}
+	std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+	static texture_library textures;
+	std::map<std::string, texture*> texture_names;
+	std::map<std::string, material*> material_names;
+	std::vector<hittable*> primitives, lights;
+	std::vector<scene_mesh_job> jobs;
+	std::vector<scene_mesh_instance> instances;
+
+	// parse, creating textures, materials and primitives as they appear
+	std::string line;
+	int number = 0;
+	while (std::getline(file, line)) {
+		number++;
+		size_t comment = line.find('#');
+		if (comment != std::string::npos)
+			line.erase(comment);
+		std::istringstream in(line);
+		std::string keyword;
+		if (!(in >> keyword))
+			continue;
+		bool ok = true;
+		std::string error;
+		if (keyword == "resolution")
+			ok = bool(in >> s.nx >> s.ny) && s.nx > 0 && s.ny > 0;
+		else if (keyword == "samples")
+			ok = bool(in >> s.ns) && s.ns > 0;
+		else if (keyword == "camera") {
+			scene_view& v = s.view;
+			ok = scene_read(in, v.lookfrom) && scene_read(in, v.lookat) && scene_read(in, v.vup) && in >> v.vfov >> v.aperture >> v.focus_dist;
+			if (ok && !(in >> v.time0 >> v.time1)) {
+				v.time0 = 0;
+				v.time1 = 1;
+			}
+		}
+		else if (keyword == "texture") {
+			std::string name, type;
+			in >> name >> type;
+			vec3 c;
+			std::string image, option;
+			if (type == "constant" && scene_read(in, c))
+				texture_names[name] = s.memory.make<constant_texture>(c);
+			else if (type == "image" && in >> image) {
+				in >> option;
+				texture* t = textures.load(scene_resolve(directory, image), option != "linear");
+				ok = t != 0;
+				texture_names[name] = t;
+			}
+			else if (type == "tiled" && in >> image) {
+				in >> option;
+				if (!s.tiles)
+					s.tiles = s.memory.make<texture_cache>(size_t(s.tile_budget) << 20);
+				texture* t = load_tiled_texture(*s.tiles, scene_resolve(directory, image), option != "linear", s.memory);
+				ok = t != 0;
+				texture_names[name] = t;
+			}
+			else
+				ok = false;
+		}
+		else if (keyword == "texture_cache") {
+			ok = bool(in >> s.tile_budget) && s.tile_budget > 0;
+			if (ok && s.tiles) {
+				ok = false;
+				error = "texture_cache has to come before the tiled textures";
+			}
+		}
+		else if (keyword == "material") {
+			std::string name, type, albedo;
+			in >> name >> type;
+			vec3 c;
+			float f;
+			texture* t = 0;
+			if (type == "lambertian" || type == "diffuse_light") {
+				std::streampos at = in.tellg();
+				if (scene_read(in, c))
+					t = s.memory.make<constant_texture>(c);
+				else {
+					in.clear();
+					in.seekg(at);
+					in >> albedo;
+					t = texture_names.count(albedo) ? texture_names[albedo] : 0;
+					error = "unknown texture " + albedo;
+				}
+			}
+			if (t && type == "lambertian")
+				material_names[name] = s.memory.make<lambertian>(t);
+			else if (t && type == "diffuse_light")
+				material_names[name] = s.memory.make<diffuse_light>(t);
+			else if (type == "metal" && scene_read(in, c) && in >> f)
+				material_names[name] = s.memory.make<metal>(c, f);
+			else if (type == "dielectric" && in >> f)
+				material_names[name] = s.memory.make<dielectric>(f);
+			else
+				ok = false;
+		}
+		else if (keyword == "sphere" || keyword == "xy_rect" || keyword == "xz_rect" || keyword == "yz_rect" || keyword == "box" || keyword == "mesh") {
+			float a[6];
+			int count = keyword == "sphere" ? 4 : keyword == "box" ? 6 : keyword == "mesh" ? 0 : 5;
+			for (int i = 0; i < count && ok; i++)
+				ok = bool(in >> a[i]);
+			std::string mesh_path, name, option;
+			if (keyword == "mesh")
+				ok = bool(in >> mesh_path);
+			ok = ok && in >> name;
+			material* mat = 0;
+			if (ok && !(keyword == "mesh" && name == "mtl")) {
+				ok = material_names.count(name) > 0;
+				mat = ok ? material_names[name] : 0;
+				error = "unknown material " + name;
+			}
+			bool spatial_splits = false;
+			std::streampos at = in.tellg();
+			if (ok && keyword == "mesh" && in >> option && option == "sbvh")
+				spatial_splits = true;
+			else {
+				in.clear();
+				in.seekg(at);
+			}
+			affine to_world;
+			bool transformed = false, flip = false;
+			if (ok && !scene_read_modifiers(in, to_world, transformed, flip)) {
+				ok = false;
+				error = "bad modifier";
+			}
+			if (ok && keyword == "mesh") {
+				// one job per file and tree type, so no two jobs write one cache.
+				// copies share its bvh and override its materials when they differ.
+				scene_mesh_instance instance;
+				instance.job = int(jobs.size());
+				for (size_t i = 0; i < jobs.size(); i++) {
+					if (jobs[i].path == scene_resolve(directory, mesh_path) && jobs[i].spatial_splits == spatial_splits)
+						instance.job = int(i);
+				}
+				if (instance.job == int(jobs.size())) {
+					scene_mesh_job job = { scene_resolve(directory, mesh_path), mat, spatial_splits, false, 0, 0, 0 };
+					jobs.push_back(job);
+				}
+				jobs[instance.job].uses_mtl = jobs[instance.job].uses_mtl || !mat;
+				instance.mat = mat;
+				instance.to_world = to_world;
+				instance.flip = flip;
+				instances.push_back(instance);
+			}
+			else if (ok) {
+				hittable* p;
+				if (keyword == "sphere")
+					p = s.memory.make<sphere>(vec3(a[0], a[1], a[2]), a[3], mat);
+				else if (keyword == "xy_rect")
+					p = s.memory.make<xy_rect>(a[0], a[1], a[2], a[3], a[4], mat);
+				else if (keyword == "xz_rect")
+					p = s.memory.make<xz_rect>(a[0], a[1], a[2], a[3], a[4], mat);
+				else if (keyword == "yz_rect")
+					p = s.memory.make<yz_rect>(a[0], a[1], a[2], a[3], a[4], mat);
+				else
+					p = s.memory.make<box>(vec3(a[0], a[1], a[2]), vec3(a[3], a[4], a[5]), mat);
+				if (flip)
+					p = s.memory.make<flip_normals>(p);
+				if (transformed)
+					p = s.memory.make<::transform>(p, to_world);
+				primitives.push_back(p);
+			}
+		}
+		else if (keyword == "light") {
+			std::string type;
+			float a[5];
+			ok = bool(in >> type);
+			int count = type == "sphere" ? 4 : 5;
+			for (int i = 0; i < count && ok; i++)
+				ok = bool(in >> a[i]);
+			if (ok && type == "sphere")
+				lights.push_back(s.memory.make<sphere>(vec3(a[0], a[1], a[2]), a[3], (material*)0));
+			else if (ok && type == "xy_rect")
+				lights.push_back(s.memory.make<xy_rect>(a[0], a[1], a[2], a[3], a[4], (material*)0));
+			else if (ok && type == "xz_rect")
+				lights.push_back(s.memory.make<xz_rect>(a[0], a[1], a[2], a[3], a[4], (material*)0));
+			else if (ok && type == "yz_rect")
+				lights.push_back(s.memory.make<yz_rect>(a[0], a[1], a[2], a[3], a[4], (material*)0));
+			else {
+				ok = false;
+				error = "cannot sample light " + type;
+			}
+		}
+		else if (keyword == "environment") {
+			std::string image;
+			float intensity = 1;
+			ok = bool(in >> image);
+			if (ok && !(in >> intensity))
+				intensity = 1;
+			s.environment = ok ? s.memory.adopt(environment_map::load(scene_resolve(directory, image), intensity)) : 0;
+			ok = ok && s.environment;
+		}
+		else {
+			ok = false;
+			error = "unknown statement " + keyword;
+		}
+		if (!ok) {
+			std::cerr << path << ":" << number << ": " << (error.empty() ? "cannot read " + keyword : error) << std::endl;
+			return false;
+		}
+	}
+	double parse_time = scene_seconds(start);
+
+	// import the meshes in parallel, each thread takes the next file. a file
+	// only makes its mtl materials, and loads their textures, if an instance
+	// keeps them, otherwise it takes the material of its first instance.
+	for (size_t i = 0; i < jobs.size(); i++) {
+		if (jobs[i].uses_mtl)
+			jobs[i].mat = 0;
+		jobs[i].memory = s.memory.make<arena>();
+	}
+	std::chrono::steady_clock::time_point mesh_start = std::chrono::steady_clock::now();
+	int threads = std::max(1, std::min(int(jobs.size()), int(std::thread::hardware_concurrency())));
+	std::atomic<int> next(0);
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; t++) {
+		workers.push_back(std::thread([&]() {
+			for (int i = next++; i < int(jobs.size()); i = next++) {
+				std::chrono::steady_clock::time_point job_start = std::chrono::steady_clock::now();
+				jobs[i].result = import_model(jobs[i].path, jobs[i].mat, jobs[i].spatial_splits, textures, *jobs[i].memory);
+				jobs[i].seconds = scene_seconds(job_start);
+			}
+			flush_stats();
+			trace_release();
+		}));
+	}
+	for (size_t t = 0; t < workers.size(); t++)
+		workers[t].join();
+	double mesh_time = scene_seconds(mesh_start);
+	for (size_t i = 0; i < jobs.size(); i++) {
+		if (!jobs[i].result) {
+			std::cerr << path << ": cannot import " << jobs[i].path << std::endl;
+			return false;
+		}
+	}
+
+	// top level: the mesh instances get their own bvh, then everything is finalized
+	load_phase.stop();
+	phase_timer build_phase(phase_build);
+	TRACE_SCOPE("build top level");
+	std::chrono::steady_clock::time_point build_start = std::chrono::steady_clock::now();
+	if (!instances.empty()) {
+		instance_bvh* meshes = s.memory.make<instance_bvh>();
+		for (size_t i = 0; i < instances.size(); i++) {
+			const scene_mesh_job& job = jobs[instances[i].job];
+			hittable* mesh = job.result;
+			if (instances[i].mat != job.mat)
+				mesh = s.memory.make<override_material>(mesh, instances[i].mat);
+			meshes->add(instances[i].flip ? s.memory.make<flip_normals>(mesh) : mesh, instances[i].to_world);
+		}
+		meshes->build();
+		primitives.push_back(meshes);
+	}
+	if (primitives.empty()) {
+		std::cerr << path << ": scene is empty" << std::endl;
+		return false;
+	}
+	s.world = finalize_scene(primitives.data(), int(primitives.size()), s.memory);
+	if (lights.size() == 1)
+		s.light_shape = lights[0];
+	else if (lights.size() > 1) {
+		hittable** light_list = s.memory.allocate_array<hittable*>(lights.size());
+		std::copy(lights.begin(), lights.end(), light_list);
+		s.light_shape = s.memory.make<hittable_list>(light_list, int(lights.size()));
+	}
+	double build_time = scene_seconds(build_start);
+
+	cout << "scene " << path << ": " << primitives.size() << " top level objects, "
+		<< instances.size() << " mesh instances of " << jobs.size() << " files" << endl;
+	cout << "  parse: " << parse_time << "s" << endl;
+	cout << "  meshes: " << mesh_time << "s on " << threads << " threads" << endl;
+	for (size_t i = 0; i < jobs.size(); i++)
+		cout << "    " << jobs[i].path << ": " << jobs[i].seconds << "s" << endl;
+	cout << "  top level bvh: " << build_time << "s" << endl;
+	cout << "  total: " << scene_seconds(start) << "s" << endl;
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,131 @@
+#pragma once
+#include <stdlib.h>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <thread>
+#include "framebuffer.h"
+
+// everything a render job may vary without recompiling. sizes left at 0 come
+// from the scene file. parsing fills in the format from the output extension
+// if it is not given.
+struct render_settings {
+	render_settings();
+
+	std::string scene_path;
+	std::string output_path;
+	std::string format;
+	std::string trace_path;	// chrome trace json, empty to not trace
+	std::string reference_path;	// write the render as a reference for --compare
+	std::string compare_path;	// reference to test the render against
+	int nx, ny, ns;
+	int max_depth;
+	int threads;
+	unsigned long long seed;
+	double time_budget;	// seconds, 0 renders exactly ns samples
+	bool heatmap;	// also write per pixel time and bvh node cost images
+	bool aovs;	// also write the first hit albedo, normal and depth
+	bool denoise;	// filter the image with the aovs before writing it
+};
+
+bool parse_render_settings(int argc, char** argv, render_settings& settings);
+void print_usage(const char* program);
+
+// render settings
+// ---------------
+render_settings::render_settings() : scene_path("resources/cornell.scene"), output_path("img/scene.ppm"), nx(0), ny(0), ns(0),
+	max_depth(50), threads(std::max(1, int(std::thread::hardware_concurrency()))), seed(0), time_budget(0), heatmap(false), aovs(false), denoise(false) {}
+
+void print_usage(const char* program) {
+	std::cerr << "usage: " << program << " [options]\n"
+		<< "  --scene PATH        scene file (default resources/cornell.scene)\n"
+		<< "  --output PATH       image to write (default img/scene.ppm)\n"
+		<< "  --format FORMAT     ppm, png, bmp, tga or hdr (default from the output extension)\n"
+		<< "  --width N           image width (default from the scene)\n"
+		<< "  --height N          image height (default from the scene)\n"
+		<< "  --spp N             samples per pixel, the cap in budget mode (default from the scene)\n"
+		<< "  --max-depth N       longest path in bounces (default 50)\n"
+		<< "  --threads N         render threads (default all cores)\n"
+		<< "  --seed N            random seed, equal seeds give equal images (default 0)\n"
+		<< "  --time-budget SEC   render passes until SEC seconds are used, then write\n"
+		<< "  --trace PATH        write a chrome trace of the load and render threads\n"
+		<< "  --heatmap           write per pixel cost next to the image, as OUTPUT.time.png/pfm\n"
+		<< "                      and OUTPUT.steps.png/pfm (bvh nodes, needs RENDER_STATS)\n"
+		<< "  --aovs              write first hit albedo, normal and depth next to the image, as\n"
+		<< "                      OUTPUT.albedo.png, OUTPUT.normal.png and OUTPUT.depth.pfm\n"
+		<< "  --denoise           write the image filtered with the aovs, references and\n"
+		<< "                      --compare still use the unfiltered samples\n"
+		<< "  --write-reference PATH  save per pixel mean and variance, best at a high spp\n"
+		<< "  --compare PATH      test the render against a reference, exit 1 if it differs\n";
+}
+
+// false on unknown options or bad values, after saying why. the image format
+// is checked here so a typo fails before the scene loads, not after the render
+bool parse_render_settings(int argc, char** argv, render_settings& settings) {
+	for (int i = 1; i < argc; i++) {
+		std::string option = argv[i];
+		if (option == "--help" || option == "-h")
+			return false;
+		if (option == "--heatmap") {
+			settings.heatmap = true;
+			continue;
+		}
+		if (option == "--aovs") {
+			settings.aovs = true;
+			continue;
+		}
+		if (option == "--denoise") {
+			settings.denoise = true;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			std::cerr << option << " needs a value" << std::endl;
+			return false;
+		}
+		const char* value = argv[++i];
+		char* end = 0;
+		bool ok = true;
+		if (option == "--scene")
+			settings.scene_path = value;
+		else if (option == "--output")
+			settings.output_path = value;
+		else if (option == "--format")
+			settings.format = value;
+		else if (option == "--trace")
+			settings.trace_path = value;
+		else if (option == "--write-reference")
+			settings.reference_path = value;
+		else if (option == "--compare")
+			settings.compare_path = value;
+		else if (option == "--width")
+			ok = (settings.nx = int(strtol(value, &end, 10))) > 0;
+		else if (option == "--height")
+			ok = (settings.ny = int(strtol(value, &end, 10))) > 0;
+		else if (option == "--spp")
+			ok = (settings.ns = int(strtol(value, &end, 10))) > 0;
+		else if (option == "--max-depth")
+			ok = (settings.max_depth = int(strtol(value, &end, 10))) >= 0;
+		else if (option == "--threads")
+			ok = (settings.threads = int(strtol(value, &end, 10))) > 0;
+		else if (option == "--seed")
+			settings.seed = strtoull(value, &end, 10);
+		else if (option == "--time-budget")
+			ok = (settings.time_budget = strtod(value, &end)) > 0;
+		else {
+			std::cerr << "unknown option " << option << std::endl;
+			return false;
+		}
+		if (!ok || (end && *end)) {
+			std::cerr << "bad value for " << option << ": " << value << std::endl;
+			return false;
+		}
+	}
+	if (settings.format.empty())
+		settings.format = image_format(settings.output_path);
+	if (!image_format_supported(settings.format)) {
+		std::cerr << "cannot write " << (settings.format.empty() ? "an image without extension" : settings.format + " images")
+			<< ", give --format ppm, png, bmp, tga or hdr" << std::endl;
+		return false;
+	}
+	return true;
+}
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include "hittable.h"
 #include "onb.h"
 #include "pdf.h"
+#include "stats.h"
 
 void get_sphere_uv(const vec3& p, float& u, float& v) {
 	float phi = atan2(p.z(), p.x());
@@ -37,6 +38,7 @@ bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 			rec.t = temp;
 			rec.p = r.point_at_parameter(rec.t);
 			get_sphere_uv((rec.p - center) / radius, rec.u, rec.v);
+			rec.uv_scale = 1 / (M_PI * radius);
 			rec.normal = (rec.p - center) / radius;
 			rec.mat_ptr = mat_ptr;
 			return true;
@@ -46,6 +48,7 @@ bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 			rec.t = temp;
 			rec.p = r.point_at_parameter(rec.t);
 			get_sphere_uv((rec.p - center) / radius, rec.u, rec.v);
+			rec.uv_scale = 1 / (M_PI * radius);
 			rec.normal = (rec.p - center) / radius;
 			rec.mat_ptr = mat_ptr;
 			return true;
@@ -61,7 +64,8 @@ bool sphere::bounding_box(float t0, float t1, aabb& box) const {
 
 float sphere::pdf_value(const vec3& o, const vec3& v) const {
 	hit_record rec;
-	if (this->hit(ray(o, v), 0.001, FLT_MAX, rec)) {
+	STAT_INC(stat_shadow_rays);
+	if (this->hit(ray(o, v, 0, already_unit), 0.001, FLT_MAX, rec)) {
 		float cos_theta_max = sqrt(1 - radius*radius/(center-o).squared_length());
 		float solid_angle = 2*M_PI*(1-cos_theta_max);
 		return  1 / solid_angle;
@@ -0,0 +1,240 @@
+#pragma once
+#include <stdint.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// render statistics. hot path counters live in a per thread block, so
+// counting is a plain add with no sharing between threads. the block is plain
+// data, which keeps the thread_local access free of initialization checks,
+// and worker threads call flush_stats before they finish to merge it into
+// the totals. build with RENDER_STATS=0 and every STAT_ macro expands to
+// nothing. phase timers are not on the hot path and always measure wall and
+// process cpu time.
+#ifndef RENDER_STATS
+#define RENDER_STATS 1
+#endif
+
+enum stat_counter {
+	stat_camera_rays,
+	stat_secondary_rays,
+	stat_shadow_rays,	// light pdf probes, the only visibility queries this integrator casts
+	stat_bvh_nodes,
+	stat_triangle_tests,
+	stat_scatter_other,	// followed by one counter per material_kind
+	stat_scatter_dielectric,
+	stat_scatter_metal,
+	stat_scatter_lambertian,
+	stat_scatter_diffuse_light,
+	stat_nans,
+	stat_counter_count
+};
+
+const int stat_path_bins = 65;	// surface hits per path, the last bin collects longer ones
+
+enum stat_phase {
+	phase_load, phase_build, phase_render, phase_denoise, phase_write, phase_count
+};
+
+struct stats_block {
+	void clear();
+	void merge();
+
+	uint64_t counters[stat_counter_count];
+	uint64_t path_length[stat_path_bins];
+};
+
+class phase_timer {
+public:
+	phase_timer(stat_phase p);
+	~phase_timer() { stop(); }
+	void stop();
+
+private:
+	stat_phase phase;
+	std::chrono::steady_clock::time_point wall_start;
+	double cpu_start;
+	bool running;
+};
+
+double process_cpu_seconds();
+size_t process_peak_memory();
+void flush_stats();
+void print_stats(std::ostream& out);
+
+// global totals
+// -------------
+struct stats_totals {
+	stats_totals() : counters(), path_length(), wall(), cpu() {}
+	std::mutex lock;
+	uint64_t counters[stat_counter_count];
+	uint64_t path_length[stat_path_bins];
+	double wall[phase_count];
+	double cpu[phase_count];
+};
+
+inline stats_totals& global_stats() {
+	static stats_totals totals;
+	return totals;
+}
+
+#if RENDER_STATS
+thread_local stats_block local_stats;
+#define STAT_ADD(counter, n) (local_stats.counters[counter] += (n))
+#define STAT_INC(counter) (++local_stats.counters[counter])
+#define STAT_PATH(length) (++local_stats.path_length[(length) < stat_path_bins ? (length) : stat_path_bins - 1])
+inline uint64_t local_stat(stat_counter counter) { return local_stats.counters[counter]; }
+#else
+#define STAT_ADD(counter, n) ((void)0)
+#define STAT_INC(counter) ((void)0)
+#define STAT_PATH(length) ((void)0)
+inline uint64_t local_stat(stat_counter counter) { return 0; }
+#endif
+
+// stats block
+// -----------
+void stats_block::clear() {
+	for (int i = 0; i < stat_counter_count; i++)
+		counters[i] = 0;
+	for (int i = 0; i < stat_path_bins; i++)
+		path_length[i] = 0;
+}
+
+// adds the counts to the totals and starts over
+void stats_block::merge() {
+	stats_totals& totals = global_stats();
+	std::lock_guard<std::mutex> guard(totals.lock);
+	for (int i = 0; i < stat_counter_count; i++)
+		totals.counters[i] += counters[i];
+	for (int i = 0; i < stat_path_bins; i++)
+		totals.path_length[i] += path_length[i];
+	clear();
+}
+
+// moves the calling thread's counts into the totals
+void flush_stats() {
+#if RENDER_STATS
+	local_stats.merge();
+#endif
+}
+
+// phase timer
+// -----------
+double process_cpu_seconds() {
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+		return 0;
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	return (k.QuadPart + u.QuadPart) * 1e-7;
+#else
+	// clock() is process cpu time here, but it is wall time on windows
+	return double(clock()) / CLOCKS_PER_SEC;
+#endif
+}
+
+// largest resident set so far in bytes, 0 where unknown
+size_t process_peak_memory() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	return size_t(usage.ru_maxrss);
+#else
+	return size_t(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+phase_timer::phase_timer(stat_phase p) : phase(p), wall_start(std::chrono::steady_clock::now()), cpu_start(process_cpu_seconds()), running(true) {}
+
+void phase_timer::stop() {
+	if (!running)
+		return;
+	running = false;
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+	double cpu = process_cpu_seconds() - cpu_start;
+	stats_totals& totals = global_stats();
+	std::lock_guard<std::mutex> guard(totals.lock);
+	totals.wall[phase] += wall;
+	totals.cpu[phase] += cpu;
+}
+
+// report
+// ------
+void print_stats(std::ostream& out) {
+	flush_stats();
+	stats_totals& totals = global_stats();
+	std::lock_guard<std::mutex> guard(totals.lock);
+	const char* phase_names[phase_count] = { "load", "build", "render", "denoise", "write" };
+	out << "phase          wall (s)     cpu (s)" << std::endl;
+	for (int i = 0; i < phase_count; i++) {
+		out << "  " << std::left << std::setw(10) << phase_names[i] << std::right << std::fixed << std::setprecision(3)
+			<< std::setw(11) << totals.wall[i] << std::setw(12) << totals.cpu[i] << std::endl;
+	}
+	out.unsetf(std::ios::fixed);
+	out << std::setprecision(6);
+	out << "peak memory: " << process_peak_memory() / (1024 * 1024) << " MB" << std::endl;
+#if RENDER_STATS
+	const uint64_t* c = totals.counters;
+	uint64_t rays = c[stat_camera_rays] + c[stat_secondary_rays] + c[stat_shadow_rays];
+	out << "rays: " << rays << " (camera " << c[stat_camera_rays] << ", secondary " << c[stat_secondary_rays]
+		<< ", shadow " << c[stat_shadow_rays] << ")" << std::endl;
+	if (rays > 0) {
+		out << "bvh nodes visited: " << c[stat_bvh_nodes] << " (" << double(c[stat_bvh_nodes]) / rays << " per ray)" << std::endl;
+		out << "triangle tests: " << c[stat_triangle_tests] << " (" << double(c[stat_triangle_tests]) / rays << " per ray)" << std::endl;
+	}
+	out << "scatters: lambertian " << c[stat_scatter_lambertian] << ", metal " << c[stat_scatter_metal]
+		<< ", dielectric " << c[stat_scatter_dielectric] << ", other " << c[stat_scatter_other] << std::endl;
+	out << "nans caught: " << c[stat_nans] << std::endl;
+	uint64_t paths = 0, hits = 0;
+	for (int i = 0; i < stat_path_bins; i++) {
+		paths += totals.path_length[i];
+		hits += i * totals.path_length[i];
+	}
+	if (paths > 0) {
+		// single lengths up to 15, then 16-31, 32-63 and the last bin
+		out << "path length: mean " << double(hits) / paths << " hits" << std::endl;
+		for (int lo = 0; lo < stat_path_bins; lo = lo < 16 ? lo + 1 : 2 * lo) {
+			int hi = lo < 16 ? lo : std::min(2 * lo, stat_path_bins) - 1;
+			uint64_t count = 0;
+			for (int i = lo; i <= hi; i++)
+				count += totals.path_length[i];
+			if (count == 0)
+				continue;
+			std::ostringstream label;
+			label << lo;
+			if (hi == stat_path_bins - 1)
+				label << "+";
+			else if (hi > lo)
+				label << "-" << hi;
+			out << "  " << std::left << std::setw(6) << label.str() << std::right << std::setw(12) << count
+				<< "  " << std::string(size_t(50.0 * count / paths + 0.5), '#') << std::endl;
+		}
+	}
+#endif
+}
\ No newline at end of file
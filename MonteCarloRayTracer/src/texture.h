@@ -1,9 +1,13 @@
 #pragma once
+#include <algorithm>
+#include <vector>
 #include "vec3.h"
 
 class texture {
 public:
 	virtual vec3 value(float u, float v, const vec3& p) const = 0;
+	// width is the size of the lookup footprint in uv units, 0 for a point
+	virtual vec3 value(float u, float v, const vec3& p, float width) const { return value(u, v, p); }
 };
 
 class constant_texture : public texture {
@@ -16,15 +20,39 @@ private:
 	vec3 color;
 };
 
+// 8 bit RGB image with a mip pyramid built at load time. texels are stored
+// RGBA in 8x8 tiles so a bilinear footprint usually stays inside one or two
+// cache lines, and bytes are converted through a 256 entry table (linear or
+// sRGB decode) instead of dividing on every lookup. lookups with a uv width
+// blend the two nearest levels, the others filter the finest level.
+const int texture_tile_bits = 3;
+const int texture_tile_size = 1 << texture_tile_bits;
+
 class image_texture : public texture {
 public:
 	image_texture() {}
-	image_texture(unsigned char* pixels, int A, int B) : data(pixels), nx(A), ny(B) {}
+	image_texture(unsigned char* pixels, int A, int B, bool srgb = false);
 	virtual vec3 value(float u, float v, const vec3& p) const override;
+	virtual vec3 value(float u, float v, const vec3& p, float width) const override;
+	int levels() const { return int(mips.size()); }
+	size_t memory_usage() const;
 
 private:
-	unsigned char* data;
-	int nx, ny;
+	struct level {
+		int nx, ny;
+		int tiles_x;
+		std::vector<unsigned char> texels;
+	};
+
+	static size_t offset(const level& l, int x, int y);
+	void store(level& l, int x, int y, const vec3& c) const;
+	vec3 texel(const level& l, int x, int y) const;
+	vec3 bilinear(const level& l, float u, float v) const;
+	unsigned char encode(float c) const;
+
+	std::vector<level> mips;
+	float decode[256];
+	bool srgb;
 };
 
 // constant texture
@@ -35,15 +63,125 @@ vec3 constant_texture::value(float u, float v, const vec3& p) const {
 
 // image texture
 // -------------
+inline float srgb_to_linear(float c) {
+	return c <= 0.04045f ? c / 12.92f : pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+inline float linear_to_srgb(float c) {
+	return c <= 0.0031308f ? 12.92f * c : 1.055f * pow(c, 1 / 2.4f) - 0.055f;
+}
+
+image_texture::image_texture(unsigned char* pixels, int A, int B, bool srgb) : srgb(srgb) {
+	for (int i = 0; i < 256; i++)
+		decode[i] = srgb ? srgb_to_linear(i / 255.0f) : i / 255.0f;
+	int nx = A, ny = B;
+	while (true) {
+		level l;
+		l.nx = nx;
+		l.ny = ny;
+		l.tiles_x = (nx + texture_tile_size - 1) >> texture_tile_bits;
+		int tiles_y = (ny + texture_tile_size - 1) >> texture_tile_bits;
+		l.texels.resize(size_t(l.tiles_x) * tiles_y * texture_tile_size * texture_tile_size * 4);
+		if (mips.empty()) {
+			for (int y = 0; y < ny; y++) {
+				for (int x = 0; x < nx; x++) {
+					const unsigned char* c = pixels + 3 * (y * nx + x);
+					unsigned char* t = &l.texels[offset(l, x, y)];
+					t[0] = c[0];
+					t[1] = c[1];
+					t[2] = c[2];
+					t[3] = 255;
+				}
+			}
+		}
+		else {
+			// box filter the previous level in linear space, odd edges are clamped
+			const level& prev = mips.back();
+			for (int y = 0; y < ny; y++) {
+				for (int x = 0; x < nx; x++) {
+					int x1 = std::min(2 * x + 1, prev.nx - 1), y1 = std::min(2 * y + 1, prev.ny - 1);
+					vec3 c = texel(prev, 2 * x, 2 * y) + texel(prev, x1, 2 * y) + texel(prev, 2 * x, y1) + texel(prev, x1, y1);
+					store(l, x, y, 0.25f * c);
+				}
+			}
+		}
+		mips.push_back(l);
+		if (nx == 1 && ny == 1)
+			break;
+		nx = std::max(nx / 2, 1);
+		ny = std::max(ny / 2, 1);
+	}
+}
+
+// byte offset of texel x, y: tiles are row major, and so are texels in a tile
+inline size_t image_texture::offset(const level& l, int x, int y) {
+	size_t tile = size_t(y >> texture_tile_bits) * l.tiles_x + (x >> texture_tile_bits);
+	int inner = (y & (texture_tile_size - 1)) << texture_tile_bits | (x & (texture_tile_size - 1));
+	return 4 * ((tile << (2 * texture_tile_bits)) | inner);
+}
+
+inline unsigned char image_texture::encode(float c) const {
+	if (srgb)
+		c = linear_to_srgb(c);
+	return (unsigned char)(std::min(std::max(c, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+inline void image_texture::store(level& l, int x, int y, const vec3& c) const {
+	unsigned char* t = &l.texels[offset(l, x, y)];
+	t[0] = encode(c.r());
+	t[1] = encode(c.g());
+	t[2] = encode(c.b());
+	t[3] = 255;
+}
+
+inline vec3 image_texture::texel(const level& l, int x, int y) const {
+	const unsigned char* t = &l.texels[offset(l, x, y)];
+	return vec3(decode[t[0]], decode[t[1]], decode[t[2]]);
+}
+
+// v runs bottom to top while rows are stored top down, edges are clamped
+vec3 image_texture::bilinear(const level& l, float u, float v) const {
+	float x = u * l.nx - 0.5f;
+	float y = (1 - v) * l.ny - 0.5f;
+	x = std::min(std::max(x, 0.0f), float(l.nx - 1));
+	y = std::min(std::max(y, 0.0f), float(l.ny - 1));
+	int x0 = int(x), y0 = int(y);
+	int x1 = std::min(x0 + 1, l.nx - 1), y1 = std::min(y0 + 1, l.ny - 1);
+	float fx = x - x0, fy = y - y0;
+	// inside a tile the neighbours are a fixed stride away
+	const unsigned char* t00 = &l.texels[offset(l, x0, y0)];
+	const unsigned char* t10 = (x0 & (texture_tile_size - 1)) != texture_tile_size - 1 ? t00 + 4 * (x1 - x0) : &l.texels[offset(l, x1, y0)];
+	const unsigned char* t01 = (y0 & (texture_tile_size - 1)) != texture_tile_size - 1 ? t00 + 4 * texture_tile_size * (y1 - y0) : &l.texels[offset(l, x0, y1)];
+	const unsigned char* t11 = t01 + (t10 - t00);
+	if ((x0 & (texture_tile_size - 1)) == texture_tile_size - 1 && (y0 & (texture_tile_size - 1)) == texture_tile_size - 1)
+		t11 = &l.texels[offset(l, x1, y1)];
+	float w00 = (1 - fx) * (1 - fy), w10 = fx * (1 - fy), w01 = (1 - fx) * fy, w11 = fx * fy;
+	vec3 c;
+	for (int i = 0; i < 3; i++)
+		c[i] = w00 * decode[t00[i]] + w10 * decode[t10[i]] + w01 * decode[t01[i]] + w11 * decode[t11[i]];
+	return c;
+}
+
 vec3 image_texture::value(float u, float v, const vec3& p) const {
-	int i = (u)*nx;
-	int j = (1 - v) * ny - 0.001;
-	if (i < 0) i = 0;
-	if (j < 0) j = 0;
-	if (i > nx - 1) i = nx - 1;
-	if (j > ny - 1) j = ny - 1;
-	float r = int(data[3 * i + 3 * nx * j]) / 255.0;
-	float g = int(data[3 * i + 3 * nx * j + 1]) / 255.0;
-	float b = int(data[3 * i + 3 * nx * j + 2]) / 255.0;
-	return vec3(r, g, b);
+	return bilinear(mips[0], u, v);
+}
+
+// width is the footprint in uv units, the level is where it covers one texel
+vec3 image_texture::value(float u, float v, const vec3& p, float width) const {
+	float texels = width * std::max(mips[0].nx, mips[0].ny);
+	if (!(texels > 1))
+		return bilinear(mips[0], u, v);
+	float lod = std::min(float(log2(texels)), float(mips.size() - 1));
+	int l = int(lod);
+	if (l >= int(mips.size()) - 1)
+		return bilinear(mips.back(), u, v);
+	float f = lod - l;
+	return (1 - f) * bilinear(mips[l], u, v) + f * bilinear(mips[l + 1], u, v);
+}
+
+size_t image_texture::memory_usage() const {
+	size_t bytes = 0;
+	for (size_t i = 0; i < mips.size(); i++)
+		bytes += mips[i].texels.size();
+	return bytes;
 }
\ No newline at end of file
@@ -0,0 +1,516 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+#include "arena.h"
+#include "stb_image.h"
+#include "texture.h"
+
+// out of core textures. convert_texture() turns an image into a file of
+// 64x64 RGBA8 tiles for every mip level, and texture_cache loads those tiles
+// on first use and keeps them under a memory budget, evicting the least
+// recently used. the cache is split into shards with their own lock and lru
+// list, and tiles are handed out as shared pointers so a tile evicted by one
+// thread stays valid for another that is still filtering it.
+//
+// scenes use it through load_tiled_texture(), which converts an image next to
+// itself on first use and again whenever the image changes.
+const char texture_file_magic[8] = { 'M', 'C', 'R', 'T', 'T', 'E', 'X', 0 };
+const uint32_t texture_file_version = 2;
+const int texture_file_tile_bits = 6;
+const int texture_file_tile_size = 1 << texture_file_tile_bits;
+const size_t texture_file_tile_bytes = 4 * texture_file_tile_size * texture_file_tile_size;
+const int texture_cache_shards = 16;
+
+struct texture_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t levels;
+	uint32_t tile_size;
+	uint32_t srgb;
+	uint64_t key;	// texture_file_key of the image it was converted from
+};
+
+struct texture_file_level {
+	uint32_t nx, ny;
+	uint32_t tiles_x, tiles_y;
+	uint64_t offset;	// first tile, tiles follow row by row
+};
+
+struct texture_cache_stats {
+	uint64_t lookups;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t bytes_read;
+	size_t resident;	// bytes of tiles held now
+	size_t peak;
+	size_t budget;
+};
+
+class texture_cache {
+public:
+	typedef std::shared_ptr<const std::vector<unsigned char> > tile_ptr;
+
+	texture_cache(size_t budget_bytes);
+	~texture_cache();
+	int open(const std::string& path, uint64_t key);	// returns a texture id, -1 if missing, stale or damaged
+	const texture_file_header& header(int texture) const { return files[texture]->header; }
+	const texture_file_level& level(int texture, int l) const { return files[texture]->levels[l]; }
+	tile_ptr tile(int texture, int level, int tx, int ty);	// null if the file cannot be read
+	texture_cache_stats stats() const;
+	void report(std::ostream& os) const;
+
+private:
+	struct file {
+		texture_file_header header;
+		std::vector<texture_file_level> levels;
+		std::string path;
+		std::ifstream in;
+		std::mutex lock;
+		bool failed;	// a read came up short, said once
+	};
+
+	struct entry {
+		uint64_t key;
+		tile_ptr data;
+	};
+
+	struct shard {
+		mutable std::mutex lock;
+		std::list<entry> lru;	// most recent first
+		std::unordered_map<uint64_t, std::list<entry>::iterator> index;
+		size_t resident;
+		uint64_t lookups, hits, evictions;
+	};
+
+	tile_ptr read(int texture, int level, int tx, int ty);
+
+	std::vector<file*> files;
+	shard shards[texture_cache_shards];
+	size_t shard_budget;
+	size_t budget;
+	mutable std::mutex stats_lock;
+	uint64_t misses;
+	uint64_t bytes_read;
+	size_t resident;
+	size_t peak;
+};
+
+// texture backed by a texture_cache, filtered like image_texture
+class cached_texture : public texture {
+public:
+	cached_texture(texture_cache* cache, int id);
+	virtual vec3 value(float u, float v, const vec3& p) const override;
+	virtual vec3 value(float u, float v, const vec3& p, float width) const override;
+
+private:
+	vec3 bilinear(int level, float u, float v) const;
+
+	texture_cache* cache;
+	int id;
+	int levels;
+	int width, height;
+	float decode[256];
+};
+
+uint64_t texture_file_key(const std::string& image_path, bool srgb);
+bool convert_texture(const std::string& image_path, const std::string& path, bool srgb);
+texture* load_tiled_texture(texture_cache& cache, const std::string& image_path, bool srgb, arena& memory);
+
+// file key
+// --------
+// fnv-1a over the image, 0 if it cannot be read
+uint64_t texture_file_key(const std::string& image_path, bool srgb) {
+	std::ifstream in(image_path, std::ios::binary);
+	if (!in)
+		return 0;
+	uint64_t hash = 14695981039346656037ull;
+	char buffer[1 << 16];
+	while (in) {
+		in.read(buffer, sizeof(buffer));
+		std::streamsize n = in.gcount();
+		for (std::streamsize i = 0; i < n; i++) {
+			hash ^= (unsigned char)buffer[i];
+			hash *= 1099511628211ull;
+		}
+	}
+	hash ^= srgb ? 1 : 0;
+	hash *= 1099511628211ull;
+	return hash;
+}
+
+// convert
+// -------
+// reads any image stb_image can, box filters the pyramid in linear space and
+// writes each level as clamped edge padded tiles. like the bvh cache the file
+// is written under a name of its own and renamed into place.
+bool convert_texture(const std::string& image_path, const std::string& path, bool srgb) {
+	int nx, ny, channels;
+	unsigned char* pixels = stbi_load(image_path.c_str(), &nx, &ny, &channels, 4);
+	if (!pixels) {
+		std::cerr << "cannot load texture " << image_path << std::endl;
+		return false;
+	}
+	std::vector<unsigned char> current(pixels, pixels + size_t(nx) * ny * 4);
+	stbi_image_free(pixels);
+
+	// alpha is always linear
+	float decode[2][256];
+	for (int i = 0; i < 256; i++) {
+		decode[0][i] = srgb ? srgb_to_linear(i / 255.0f) : i / 255.0f;
+		decode[1][i] = i / 255.0f;
+	}
+
+	std::vector<std::vector<unsigned char> > pyramid;
+	std::vector<texture_file_level> levels;
+	while (true) {
+		texture_file_level l;
+		l.nx = nx;
+		l.ny = ny;
+		l.tiles_x = (nx + texture_file_tile_size - 1) >> texture_file_tile_bits;
+		l.tiles_y = (ny + texture_file_tile_size - 1) >> texture_file_tile_bits;
+		l.offset = 0;
+		levels.push_back(l);
+		pyramid.push_back(current);
+		if (nx == 1 && ny == 1)
+			break;
+		int mx = std::max(nx / 2, 1), my = std::max(ny / 2, 1);
+		std::vector<unsigned char> next(size_t(mx) * my * 4);
+		for (int y = 0; y < my; y++) {
+			for (int x = 0; x < mx; x++) {
+				int x0 = std::min(2 * x, nx - 1), x1 = std::min(2 * x + 1, nx - 1);
+				int y0 = std::min(2 * y, ny - 1), y1 = std::min(2 * y + 1, ny - 1);
+				for (int c = 0; c < 4; c++) {
+					const float* table = decode[c == 3];
+					float sum = table[current[4 * (size_t(y0) * nx + x0) + c]] + table[current[4 * (size_t(y0) * nx + x1) + c]]
+						+ table[current[4 * (size_t(y1) * nx + x0) + c]] + table[current[4 * (size_t(y1) * nx + x1) + c]];
+					float linear = 0.25f * sum;
+					float encoded = srgb && c < 3 ? linear_to_srgb(linear) : linear;
+					next[4 * (size_t(y) * mx + x) + c] = (unsigned char)(std::min(std::max(encoded, 0.0f), 1.0f) * 255.0f + 0.5f);
+				}
+			}
+		}
+		current.swap(next);
+		nx = mx;
+		ny = my;
+	}
+
+	texture_file_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, texture_file_magic, sizeof(header.magic));
+	header.version = texture_file_version;
+	header.width = levels[0].nx;
+	header.height = levels[0].ny;
+	header.levels = uint32_t(levels.size());
+	header.tile_size = texture_file_tile_size;
+	header.srgb = srgb ? 1 : 0;
+	header.key = texture_file_key(image_path, srgb);
+	uint64_t offset = sizeof(header) + levels.size() * sizeof(texture_file_level);
+	for (size_t i = 0; i < levels.size(); i++) {
+		levels[i].offset = offset;
+		offset += uint64_t(levels[i].tiles_x) * levels[i].tiles_y * texture_file_tile_bytes;
+	}
+
+	std::ostringstream unique;
+#ifdef _WIN32
+	unique << path << ".tmp" << _getpid() << "." << std::hash<std::thread::id>()(std::this_thread::get_id());
+#else
+	unique << path << ".tmp" << getpid() << "." << std::hash<std::thread::id>()(std::this_thread::get_id());
+#endif
+	std::string temporary = unique.str();
+	std::ofstream out(temporary, std::ios::binary);
+	out.write((const char*)&header, sizeof(header));
+	out.write((const char*)&levels[0], levels.size() * sizeof(texture_file_level));
+	std::vector<unsigned char> tile(texture_file_tile_bytes);
+	for (size_t i = 0; i < levels.size(); i++) {
+		const texture_file_level& l = levels[i];
+		const std::vector<unsigned char>& texels = pyramid[i];
+		for (uint32_t ty = 0; ty < l.tiles_y; ty++) {
+			for (uint32_t tx = 0; tx < l.tiles_x; tx++) {
+				for (int y = 0; y < texture_file_tile_size; y++) {
+					int sy = std::min(int(ty) * texture_file_tile_size + y, int(l.ny) - 1);
+					for (int x = 0; x < texture_file_tile_size; x++) {
+						int sx = std::min(int(tx) * texture_file_tile_size + x, int(l.nx) - 1);
+						memcpy(&tile[4 * (y * texture_file_tile_size + x)], &texels[4 * (size_t(sy) * l.nx + sx)], 4);
+					}
+				}
+				out.write((const char*)&tile[0], tile.size());
+			}
+		}
+	}
+	bool written = bool(out);
+	out.close();
+#ifdef _WIN32
+	bool renamed = written && MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	bool renamed = written && rename(temporary.c_str(), path.c_str()) == 0;
+#endif
+	if (!renamed)
+		remove(temporary.c_str());
+	return renamed;
+}
+
+// load
+// ----
+// the tiles of image.png go to image.png.tex, or image.png.linear.tex for
+// data that is not srgb. returns 0 if the image cannot be read.
+texture* load_tiled_texture(texture_cache& cache, const std::string& image_path, bool srgb, arena& memory) {
+	uint64_t key = texture_file_key(image_path, srgb);
+	if (key == 0) {
+		std::cerr << "cannot load texture " << image_path << std::endl;
+		return 0;
+	}
+	std::string path = image_path + (srgb ? ".tex" : ".linear.tex");
+	int id = cache.open(path, key);
+	if (id < 0 && convert_texture(image_path, path, srgb))
+		id = cache.open(path, key);
+	if (id < 0) {
+		std::cerr << "cannot write texture file " << path << std::endl;
+		return 0;
+	}
+	return memory.make<cached_texture>(&cache, id);
+}
+
+// texture cache
+// -------------
+texture_cache::texture_cache(size_t budget_bytes) : budget(budget_bytes), misses(0), bytes_read(0), resident(0), peak(0) {
+	shard_budget = budget / texture_cache_shards;
+	for (int i = 0; i < texture_cache_shards; i++) {
+		shards[i].resident = 0;
+		shards[i].lookups = 0;
+		shards[i].hits = 0;
+		shards[i].evictions = 0;
+	}
+}
+
+texture_cache::~texture_cache() {
+	for (size_t i = 0; i < files.size(); i++)
+		delete files[i];
+}
+
+// the level table must be the one convert_texture writes for the image size,
+// with the tiles packed up to the end of the file, so every tile read lands
+// inside it. a damaged file is said and rejected, and gets converted again.
+int texture_cache::open(const std::string& path, uint64_t key) {
+	file* f = new file();
+	f->path = path;
+	f->failed = false;
+	f->in.open(path, std::ios::binary | std::ios::ate);
+	uint64_t size = f->in ? uint64_t(f->in.tellg()) : 0;
+	f->in.seekg(0);
+	if (f->in)
+		f->in.read((char*)&f->header, sizeof(f->header));
+	if (!f->in || memcmp(f->header.magic, texture_file_magic, sizeof(texture_file_magic)) != 0
+		|| f->header.version != texture_file_version || f->header.key != key) {
+		delete f;
+		return -1;
+	}
+	const texture_file_header& h = f->header;
+	uint32_t levels = 1;
+	while (std::max(h.width, h.height) >> levels)
+		levels++;
+	bool valid = h.tile_size == texture_file_tile_size && h.width > 0 && h.height > 0 && h.levels == levels;
+	if (valid) {
+		f->levels.resize(h.levels);
+		f->in.read((char*)&f->levels[0], f->levels.size() * sizeof(texture_file_level));
+		valid = bool(f->in);
+	}
+	uint64_t offset = sizeof(h) + uint64_t(h.levels) * sizeof(texture_file_level);
+	for (uint32_t i = 0; valid && i < h.levels; i++) {
+		const texture_file_level& l = f->levels[i];
+		uint64_t tiles = uint64_t(l.tiles_x) * l.tiles_y;
+		valid = l.nx == std::max(h.width >> i, 1u) && l.ny == std::max(h.height >> i, 1u)
+			&& l.tiles_x == (l.nx + texture_file_tile_size - 1) >> texture_file_tile_bits
+			&& l.tiles_y == (l.ny + texture_file_tile_size - 1) >> texture_file_tile_bits
+			&& tiles < (1ull << 32) && l.offset == offset;
+		offset += tiles * texture_file_tile_bytes;
+	}
+	if (!valid || offset != size) {
+		std::cerr << "texture file " << path << " is damaged" << std::endl;
+		delete f;
+		return -1;
+	}
+	files.push_back(f);
+	return int(files.size()) - 1;
+}
+
+texture_cache::tile_ptr texture_cache::read(int texture, int level, int tx, int ty) {
+	file* f = files[texture];
+	const texture_file_level& l = f->levels[level];
+	std::shared_ptr<std::vector<unsigned char> > data = std::make_shared<std::vector<unsigned char> >(texture_file_tile_bytes);
+	{
+		std::lock_guard<std::mutex> guard(f->lock);
+		f->in.seekg(std::streamoff(l.offset + (uint64_t(ty) * l.tiles_x + tx) * texture_file_tile_bytes));
+		f->in.read((char*)&(*data)[0], texture_file_tile_bytes);
+		bool complete = f->in.gcount() == std::streamsize(texture_file_tile_bytes);
+		f->in.clear();
+		if (!complete) {
+			if (!f->failed)
+				std::cerr << "cannot read tiles of " << f->path << ", it changed after it was opened" << std::endl;
+			f->failed = true;
+			return tile_ptr();
+		}
+	}
+	return data;
+}
+
+// the disk read happens outside the shard lock, if two threads miss the same
+// tile the first one to insert it wins. a failed read is not cached.
+texture_cache::tile_ptr texture_cache::tile(int texture, int level, int tx, int ty) {
+	uint64_t key = (uint64_t(texture) << 40) | (uint64_t(level) << 32) | (uint64_t(ty) * files[texture]->levels[level].tiles_x + tx);
+	shard& s = shards[((key * 0x9e3779b97f4a7c15ull) >> 32) % texture_cache_shards];
+	{
+		std::lock_guard<std::mutex> guard(s.lock);
+		s.lookups++;
+		std::unordered_map<uint64_t, std::list<entry>::iterator>::iterator found = s.index.find(key);
+		if (found != s.index.end()) {
+			s.hits++;
+			s.lru.splice(s.lru.begin(), s.lru, found->second);
+			return found->second->data;
+		}
+	}
+
+	tile_ptr data = read(texture, level, tx, ty);
+	if (!data)
+		return data;
+	size_t freed = 0;
+	{
+		std::lock_guard<std::mutex> guard(s.lock);
+		std::unordered_map<uint64_t, std::list<entry>::iterator>::iterator found = s.index.find(key);
+		if (found != s.index.end())
+			return found->second->data;
+		entry e;
+		e.key = key;
+		e.data = data;
+		s.lru.push_front(e);
+		s.index[key] = s.lru.begin();
+		s.resident += texture_file_tile_bytes;
+		while (s.resident > shard_budget && s.lru.size() > 1) {
+			s.index.erase(s.lru.back().key);
+			s.lru.pop_back();
+			s.resident -= texture_file_tile_bytes;
+			s.evictions++;
+			freed += texture_file_tile_bytes;
+		}
+	}
+	std::lock_guard<std::mutex> guard(stats_lock);
+	misses++;
+	bytes_read += texture_file_tile_bytes;
+	resident += texture_file_tile_bytes;
+	resident -= freed;
+	peak = std::max(peak, resident);
+	return data;
+}
+
+texture_cache_stats texture_cache::stats() const {
+	texture_cache_stats st;
+	memset(&st, 0, sizeof(st));
+	for (int i = 0; i < texture_cache_shards; i++) {
+		std::lock_guard<std::mutex> guard(shards[i].lock);
+		st.lookups += shards[i].lookups;
+		st.hits += shards[i].hits;
+		st.evictions += shards[i].evictions;
+	}
+	std::lock_guard<std::mutex> guard(stats_lock);
+	st.misses = misses;
+	st.bytes_read = bytes_read;
+	st.resident = resident;
+	st.peak = peak;
+	st.budget = budget;
+	return st;
+}
+
+void texture_cache::report(std::ostream& os) const {
+	texture_cache_stats st = stats();
+	os << "texture cache: " << st.lookups << " lookups, hit rate "
+		<< (st.lookups ? 100.0 * st.hits / st.lookups : 0.0) << "%, "
+		<< st.misses << " tiles read (" << st.bytes_read / (1 << 20) << " MB), " << st.evictions << " evicted" << std::endl;
+	os << "  resident " << st.resident / (1 << 20) << " MB, peak " << st.peak / (1 << 20)
+		<< " MB, budget " << st.budget / (1 << 20) << " MB" << std::endl;
+}
+
+// cached texture
+// --------------
+cached_texture::cached_texture(texture_cache* cache, int id) : cache(cache), id(id) {
+	const texture_file_header& h = cache->header(id);
+	levels = h.levels;
+	width = h.width;
+	height = h.height;
+	for (int i = 0; i < 256; i++)
+		decode[i] = h.srgb ? srgb_to_linear(i / 255.0f) : i / 255.0f;
+}
+
+// the four texels usually share a tile, each distinct tile is fetched once.
+// texels of tiles that cannot be read count as black
+vec3 cached_texture::bilinear(int level, float u, float v) const {
+	const texture_file_level& l = cache->level(id, level);
+	float x = u * l.nx - 0.5f;
+	float y = (1 - v) * l.ny - 0.5f;
+	x = std::min(std::max(x, 0.0f), float(l.nx - 1));
+	y = std::min(std::max(y, 0.0f), float(l.ny - 1));
+	int xs[2], ys[2];
+	xs[0] = int(x);
+	ys[0] = int(y);
+	xs[1] = std::min(xs[0] + 1, int(l.nx) - 1);
+	ys[1] = std::min(ys[0] + 1, int(l.ny) - 1);
+	float fx = x - xs[0], fy = y - ys[0];
+	float weights[4] = { (1 - fx) * (1 - fy), fx * (1 - fy), (1 - fx) * fy, fx * fy };
+	texture_cache::tile_ptr tiles[4];
+	int keys[4];
+	vec3 c(0, 0, 0);
+	for (int i = 0; i < 4; i++) {
+		int tx = xs[i & 1] >> texture_file_tile_bits, ty = ys[i >> 1] >> texture_file_tile_bits;
+		keys[i] = ty * l.tiles_x + tx;
+		for (int j = 0; j < i && !tiles[i]; j++) {
+			if (keys[j] == keys[i])
+				tiles[i] = tiles[j];
+		}
+		if (!tiles[i])
+			tiles[i] = cache->tile(id, level, tx, ty);
+		if (!tiles[i])
+			continue;
+		int inner = ((ys[i >> 1] & (texture_file_tile_size - 1)) << texture_file_tile_bits) | (xs[i & 1] & (texture_file_tile_size - 1));
+		const unsigned char* t = &(*tiles[i])[4 * inner];
+		c += weights[i] * vec3(decode[t[0]], decode[t[1]], decode[t[2]]);
+	}
+	return c;
+}
+
+vec3 cached_texture::value(float u, float v, const vec3& p) const {
+	return bilinear(0, u, v);
+}
+
+vec3 cached_texture::value(float u, float v, const vec3& p, float width) const {
+	float texels = width * std::max(this->width, height);
+	if (!(texels > 1))
+		return bilinear(0, u, v);
+	float lod = std::min(float(log2(texels)), float(levels - 1));
+	int l = int(lod);
+	if (l >= levels - 1)
+		return bilinear(levels - 1, u, v);
+	float f = lod - l;
+	return (1 - f) * bilinear(l, u, v) + f * bilinear(l + 1, u, v);
+}
\ No newline at end of file
@@ -0,0 +1,211 @@
+#pragma once
+#include <stdint.h>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// timeline of what every thread did, written as chrome trace json for
+// chrome://tracing or ui.perfetto.dev. events are complete ("X") events with
+// a start and a duration, recorded into a buffer owned by the calling thread
+// without any locking. a thread takes a buffer from a pool on its first event
+// and hands it back with trace_release when it finishes, so the short lived
+// threads of successive render passes reuse a few buffers and show up as a
+// few stable tracks. tracing is off until trace_start; build with
+// RENDER_TRACE=0 and the TRACE_ macros expand to nothing.
+#ifndef RENDER_TRACE
+#define RENDER_TRACE 1
+#endif
+
+const size_t trace_max_events = 1 << 20;	// per buffer, later events are counted and dropped
+
+struct trace_event {
+	const char* name;	// must outlive the trace, normally a literal
+	std::string detail;
+	int64_t start, duration;	// nanoseconds since trace_start
+	const char* arg_names[2];	// literals too, 0 for no argument
+	int args[2];
+};
+
+struct trace_buffer {
+	std::vector<trace_event> events;
+	size_t dropped;
+	int track;
+};
+
+struct trace_state {
+	trace_state() : enabled(false) {}
+	bool enabled;
+	std::chrono::steady_clock::time_point origin;
+	std::mutex lock;
+	std::vector<trace_buffer*> buffers;
+	std::vector<trace_buffer*> free_buffers;
+};
+
+class trace_scope {
+public:
+	trace_scope(const char* name, const char* arg0 = 0, int value0 = 0, const char* arg1 = 0, int value1 = 0);
+	trace_scope(const char* name, const std::string& detail);
+	~trace_scope();
+
+private:
+	trace_event e;
+};
+
+void trace_start();
+void trace_release();
+bool trace_write(const std::string& path);
+
+#if RENDER_TRACE
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(...) trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
+#else
+#define TRACE_SCOPE(...) ((void)0)
+#endif
+
+// trace state
+// -----------
+inline trace_state& global_trace() {
+	static trace_state state;
+	return state;
+}
+
+thread_local trace_buffer* local_trace = 0;
+
+inline int64_t trace_now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - global_trace().origin).count();
+}
+
+inline trace_buffer* trace_acquire();
+
+// the calling thread takes the first buffer and keeps it, so loading and the
+// passes it runs itself stay on track 0 whichever worker records first
+void trace_start() {
+	trace_state& state = global_trace();
+	state.origin = std::chrono::steady_clock::now();
+	state.enabled = true;
+	if (!local_trace)
+		local_trace = trace_acquire();
+}
+
+inline trace_buffer* trace_acquire() {
+	trace_state& state = global_trace();
+	std::lock_guard<std::mutex> guard(state.lock);
+	trace_buffer* buffer;
+	if (!state.free_buffers.empty()) {
+		buffer = state.free_buffers.back();
+		state.free_buffers.pop_back();
+	}
+	else {
+		buffer = new trace_buffer();
+		buffer->dropped = 0;
+		buffer->track = int(state.buffers.size());
+		state.buffers.push_back(buffer);
+	}
+	return buffer;
+}
+
+// gives the calling thread's buffer back to the pool, call before a worker ends
+void trace_release() {
+	if (!local_trace)
+		return;
+	trace_state& state = global_trace();
+	std::lock_guard<std::mutex> guard(state.lock);
+	state.free_buffers.push_back(local_trace);
+	local_trace = 0;
+}
+
+// trace scope
+// -----------
+// a negative start marks a scope opened while tracing was off
+trace_scope::trace_scope(const char* name, const char* arg0, int value0, const char* arg1, int value1) {
+	e.name = name;
+	e.arg_names[0] = arg0;
+	e.arg_names[1] = arg1;
+	e.args[0] = value0;
+	e.args[1] = value1;
+	e.start = global_trace().enabled ? trace_now() : -1;
+}
+
+trace_scope::trace_scope(const char* name, const std::string& detail) {
+	e.name = name;
+	e.arg_names[0] = e.arg_names[1] = 0;
+	e.start = global_trace().enabled ? trace_now() : -1;
+	if (e.start >= 0)
+		e.detail = detail;
+}
+
+trace_scope::~trace_scope() {
+	if (e.start < 0)
+		return;
+	e.duration = trace_now() - e.start;
+	if (!local_trace)
+		local_trace = trace_acquire();
+	if (local_trace->events.size() >= trace_max_events)
+		local_trace->dropped++;
+	else
+		local_trace->events.push_back(std::move(e));
+}
+
+// export
+// ------
+inline void trace_write_string(std::ostream& out, const std::string& s) {
+	out << '"';
+	for (size_t i = 0; i < s.size(); i++) {
+		char c = s[i];
+		if (c == '"' || c == '\\')
+			out << '\\' << c;
+		else if ((unsigned char)c < 0x20)
+			out << ' ';
+		else
+			out << c;
+	}
+	out << '"';
+}
+
+// call once every traced thread has finished or released its buffer
+bool trace_write(const std::string& path) {
+	std::ofstream out(path);
+	if (!out)
+		return false;
+	trace_state& state = global_trace();
+	std::lock_guard<std::mutex> guard(state.lock);
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	bool first = true;
+	size_t dropped = 0;
+	for (size_t i = 0; i < state.buffers.size(); i++) {
+		const trace_buffer* buffer = state.buffers[i];
+		dropped += buffer->dropped;
+		out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->track
+			<< ",\"args\":{\"name\":\"" << (buffer->track == 0 ? std::string("main") : "worker " + std::to_string(buffer->track)) << "\"}}";
+		first = false;
+		for (size_t j = 0; j < buffer->events.size(); j++) {
+			const trace_event& e = buffer->events[j];
+			out << ",\n{\"name\":";
+			trace_write_string(out, e.name);
+			out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->track << ",\"ts\":" << e.start / 1000 << "." << e.start % 1000 / 100
+				<< ",\"dur\":" << e.duration / 1000 << "." << e.duration % 1000 / 100;
+			if (!e.detail.empty() || e.arg_names[0]) {
+				out << ",\"args\":{";
+				const char* separator = "";
+				if (!e.detail.empty()) {
+					out << "\"detail\":";
+					trace_write_string(out, e.detail);
+					separator = ",";
+				}
+				for (int k = 0; k < 2 && e.arg_names[k]; k++) {
+					out << separator;
+					trace_write_string(out, e.arg_names[k]);
+					out << ":" << e.args[k];
+					separator = ",";
+				}
+				out << "}";
+			}
+			out << "}";
+		}
+	}
+	out << "\n],\"otherData\":{\"dropped_events\":" << dropped << "}}\n";
+	return bool(out);
+}
\ No newline at end of file
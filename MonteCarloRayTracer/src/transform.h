@@ -1,4 +1,10 @@
 #pragma once
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define TRANSFORM_SSE
+#endif
+#include "affine.h"
+#include "arena.h"
 #include "hittable.h"
 
 class flip_normals : public hittable {
@@ -6,16 +12,31 @@ public:
 	flip_normals(hittable* p) : ptr(p) {}
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
 	virtual bool bounding_box(float t0, float t1, aabb& box) const override;
+	hittable* child() const { return ptr; }
 
 private:
 	hittable* ptr;
 };
 
+// gives every hit of a shared model one material, for instances of a mesh
+// that override the material it was imported with
+class override_material : public hittable {
+public:
+	override_material(hittable* p, material* mat) : ptr(p), mat(mat) {}
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+	virtual bool bounding_box(float t0, float t1, aabb& box) const override;
+
+private:
+	hittable* ptr;
+	material* mat;
+};
+
 class translate : public hittable {
 public:
 	translate(hittable* p, const vec3& offset) : ptr(p), offset(offset) {}
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
 	virtual bool bounding_box(float t0, float t1, aabb& box) const override;
+	virtual hittable* as_transform(affine& to_world) const override;
 
 private:
 	hittable* ptr;
@@ -27,6 +48,7 @@ public:
 	rotate_y(hittable* p, float angle);
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
 	virtual bool bounding_box(float t0, float t1, aabb& box) const override;
+	virtual hittable* as_transform(affine& to_world) const override;
 
 private:
 	hittable* ptr;
@@ -36,6 +58,28 @@ private:
 	aabb bbox;
 };
 
+// general affine transform with the inverse and the normal matrix cached, so
+// a chain of translate/rotate_y wrappers collapses into a single node
+class transform : public hittable {
+public:
+	transform(hittable* p, const affine& to_world);
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+	virtual bool bounding_box(float t0, float t1, aabb& box) const override;
+	virtual hittable* as_transform(affine& to_world) const override;
+
+private:
+	void to_object(const ray& r, vec3& origin, vec3& direction) const;
+
+	hittable* ptr;
+	affine world;
+	affine object;
+	float normal_matrix[3][3];
+	// columns of the world to object matrix, w = 0
+	float columns[4][4];
+	bool hasbox;
+	aabb bbox;
+};
+
 // flip normals
 // ------------
 bool flip_normals::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
@@ -51,10 +95,25 @@ bool flip_normals::bounding_box(float t0, float t1, aabb& box) const {
 	return ptr->bounding_box(t0, t1, box);
 }
 
+// override material
+// -----------------
+bool override_material::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+	if (ptr->hit(r, t_min, t_max, rec)) {
+		rec.mat_ptr = mat;
+		return true;
+	}
+	else
+		return false;
+}
+
+bool override_material::bounding_box(float t0, float t1, aabb& box) const {
+	return ptr->bounding_box(t0, t1, box);
+}
+
 // translate
 // ---------
 bool translate::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
-	ray moved_r(r.origin() - offset, r.direction(), r.time());
+	ray moved_r(r.origin() - offset, r.direction(), r.time(), already_unit);
 	if (ptr->hit(moved_r, t_min, t_max, rec)) {
 		rec.p += offset;
 		return true;
@@ -72,6 +131,11 @@ bool translate::bounding_box(float t0, float t1, aabb& box) const {
 		return false;
 }
 
+hittable* translate::as_transform(affine& to_world) const {
+	to_world = affine::translation(offset);
+	return ptr;
+}
+
 // rotate y
 // --------
 rotate_y::rotate_y(hittable* p, float angle) : ptr(p) {
@@ -109,7 +173,7 @@ bool rotate_y::hit(const ray& r, float t_min, float t_max, hit_record& rec) cons
 	origin[2] = sin_theta * r.origin()[0] + cos_theta * r.origin()[2];
 	direction[0] = cos_theta * r.direction()[0] - sin_theta * r.direction()[2];
 	direction[2] = sin_theta * r.direction()[0] + cos_theta * r.direction()[2];
-	ray rotated_r(origin, direction, r.time());
+	ray rotated_r(origin, direction, r.time(), already_unit);
 	if (ptr->hit(rotated_r, t_min, t_max, rec)) {
 		vec3 p = rec.p;
 		vec3 normal = rec.normal;
@@ -128,4 +192,103 @@ bool rotate_y::hit(const ray& r, float t_min, float t_max, hit_record& rec) cons
 bool rotate_y::bounding_box(float t0, float t1, aabb& box) const {
 	box = bbox;
 	return hasbox;
+}
+
+hittable* rotate_y::as_transform(affine& to_world) const {
+	to_world = affine();
+	to_world.m[0][0] = cos_theta;
+	to_world.m[0][2] = sin_theta;
+	to_world.m[2][0] = -sin_theta;
+	to_world.m[2][2] = cos_theta;
+	return ptr;
+}
+
+// transform
+// ---------
+transform::transform(hittable* p, const affine& to_world) : ptr(p), world(to_world) {
+	object = world.inverse();
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++)
+			normal_matrix[i][j] = object.m[j][i];
+	}
+	for (int j = 0; j < 4; j++) {
+		for (int i = 0; i < 3; i++)
+			columns[j][i] = object.m[i][j];
+		columns[j][3] = 0;
+	}
+	hasbox = ptr->bounding_box(0, 1, bbox);
+	if (hasbox)
+		bbox = world.box(bbox);
+}
+
+inline void transform::to_object(const ray& r, vec3& origin, vec3& direction) const {
+	const vec3& o = r.origin();
+	const vec3& d = r.direction();
+#ifdef TRANSFORM_SSE
+	__m128 c0 = _mm_loadu_ps(columns[0]);
+	__m128 c1 = _mm_loadu_ps(columns[1]);
+	__m128 c2 = _mm_loadu_ps(columns[2]);
+	__m128 c3 = _mm_loadu_ps(columns[3]);
+	__m128 ro = _mm_add_ps(
+		_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(o.x())), _mm_mul_ps(c1, _mm_set1_ps(o.y()))),
+		_mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(o.z())), c3));
+	__m128 rd = _mm_add_ps(
+		_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(d.x())), _mm_mul_ps(c1, _mm_set1_ps(d.y()))),
+		_mm_mul_ps(c2, _mm_set1_ps(d.z())));
+	float out[8];
+	_mm_storeu_ps(out, ro);
+	_mm_storeu_ps(out + 4, rd);
+	origin = vec3(out[0], out[1], out[2]);
+	direction = vec3(out[4], out[5], out[6]);
+#else
+	origin = object.point(o);
+	direction = object.vector(d);
+#endif
+}
+
+bool transform::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+	vec3 origin, direction;
+	to_object(r, origin, direction);
+	// the object space ray is renormalized, scale maps world t to object t
+	float scale = direction.length();
+	ray object_r(origin, direction / scale, r.time(), already_unit);
+	if (ptr->hit(object_r, t_min * scale, t_max * scale, rec)) {
+		rec.t /= scale;
+		rec.uv_scale *= scale;
+		rec.p = r.point_at_parameter(rec.t);
+		vec3 n = rec.normal;
+		rec.normal = unit_vector(vec3(
+			normal_matrix[0][0] * n.x() + normal_matrix[0][1] * n.y() + normal_matrix[0][2] * n.z(),
+			normal_matrix[1][0] * n.x() + normal_matrix[1][1] * n.y() + normal_matrix[1][2] * n.z(),
+			normal_matrix[2][0] * n.x() + normal_matrix[2][1] * n.y() + normal_matrix[2][2] * n.z()
+		));
+		return true;
+	}
+	else
+		return false;
+}
+
+bool transform::bounding_box(float t0, float t1, aabb& box) const {
+	box = bbox;
+	return hasbox;
+}
+
+hittable* transform::as_transform(affine& to_world) const {
+	to_world = world;
+	return ptr;
+}
+
+// collapse a chain of transform wrappers into one transform node
+hittable* flatten_transforms(hittable* p, arena& memory) {
+	affine to_world;
+	hittable* child = p->as_transform(to_world);
+	if (!child)
+		return p;
+	affine inner;
+	hittable* next;
+	while ((next = child->as_transform(inner)) != 0) {
+		to_world = to_world * inner;
+		child = next;
+	}
+	return memory.make<transform>(child, to_world);
 }
\ No newline at end of file
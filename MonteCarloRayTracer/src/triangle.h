@@ -2,11 +2,61 @@
 #include "hittable.h"
 #include "mesh.h"
 #include "random.h"
+#include "stats.h"
 
+// moller-trumbore ray/triangle test, shared with the cached mesh format
+inline bool intersect_triangle(const ray& r, const vec3& v0, const vec3& v1, const vec3& v2, float t_min, float t_max, float& t, float& u, float& v) {
+	STAT_INC(stat_triangle_tests);
+	vec3 o = r.origin();
+	vec3 d = r.direction();
+
+	// calculate E1, E2, P, T, Q, det
+	vec3 E1 = v1 - v0;
+	vec3 E2 = v2 - v0;
+	vec3 P = cross(d, E2);
+	float det = dot(P, E1);
+	if (abs(det) < 1e-5f) {
+		return false;
+	}
+	vec3 T;
+	if (det > 0.0f) {
+		T = o - v0;
+	}
+	else {
+		T = v0 - o;
+		det = -det;
+	}
+	vec3 Q = cross(T, E1);
+
+	// calculate u, v, t
+	float invDet = 1.0f / det;
+	u = dot(T, P) * invDet;
+	if (u < 0.0f || u > 1.0f)
+		return false;
+	v = dot(Q, d) * invDet;
+	if (v < 0.0f || u + v > 1.0f)
+		return false;
+	t = dot(Q, E2) * invDet;
+	if (t < t_min || t > t_max)
+		return false;
+	return true;
+}
+
+// texture coordinates per unit of surface distance, 0 without a uv mapping
+inline float triangle_uv_scale(const vec3& v0, const vec3& v1, const vec3& v2, const float uv[3][2]) {
+	float world_area = cross(v1 - v0, v2 - v0).length();
+	float uv_area = fabs((uv[1][0] - uv[0][0]) * (uv[2][1] - uv[0][1]) - (uv[2][0] - uv[0][0]) * (uv[1][1] - uv[0][1]));
+	return world_area > 0 ? sqrt(uv_area / world_area) : 0;
+}
+
+// corner normals and uvs are kept in the compact encodings of vertex.h. the
+// trees find the closest hit with intersect() and decode them once in shade().
 class Triangle : public hittable {
 public:
 	vec3 v0, v1, v2;
-	vec3 n0, n1, n2;
+	packed_normal n[3];
+	packed_uv uv[3][2];
+	float uv_scale;
 	material* mat;
 	aabb box;
 
@@ -14,54 +64,41 @@ public:
 		this->v0 = vertex0.position;
 		this->v1 = vertex1.position;
 		this->v2 = vertex2.position;
-		this->n0 = vertex0.normal;
-		this->n1 = vertex1.normal;
-		this->n2 = vertex2.normal;
+		const Vertex* vertices[3] = { &vertex0, &vertex1, &vertex2 };
+		float corner_uv[3][2];
+		for (int k = 0; k < 3; k++) {
+			this->n[k] = pack_normal(vertices[k]->normal);
+			corner_uv[k][0] = vertices[k]->u;
+			corner_uv[k][1] = vertices[k]->v;
+			this->uv[k][0] = pack_uv(corner_uv[k][0]);
+			this->uv[k][1] = pack_uv(corner_uv[k][1]);
+		}
+		this->uv_scale = triangle_uv_scale(v0, v1, v2, corner_uv);
 		this->mat = mat;
 		bounding_box(0.0f, 1.0f, this->box);
 	}
 
-	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override {
-		vec3 o = r.origin();
-		vec3 d = r.direction();
-
-		// calculate E1, E2, P, T, Q, det
-		vec3 E1 = v1 - v0;
-		vec3 E2 = v2 - v0;
-		vec3 P = cross(d, E2);
-		float det = dot(P, E1);
-		if (abs(det) < 1e-5f) {
-			return false;
-		}
-		vec3 T;
-		if (det > 0.0f) {
-			T = o - v0;
-		}
-		else {
-			T = v0 - o;
-			det = -det;
-		}
-		vec3 Q = cross(T, E1);
-
-		// calculate u, v, t
-		float invDet = 1.0f / det;
-		float u = dot(T, P) * invDet;
-		if (u < 0.0f || u > 1.0f)
-			return false;
-		float v = dot(Q, d) * invDet;
-		if (v < 0.0f || u + v > 1.0f)
-			return false;
-		float t = dot(Q, E2) * invDet;
-		if (t < t_min || t > t_max)
-			return false;
+	bool intersect(const ray& r, float t_min, float t_max, float& t, float& u, float& v) const {
+		return intersect_triangle(r, v0, v1, v2, t_min, t_max, t, u, v);
+	}
 
-		// fill hit record struct
-		rec.u = u;
-		rec.v = v;
+	// fills the record for a hit intersect() found at t, u, v
+	void shade(const ray& r, float t, float u, float v, hit_record& rec) const {
+		float w = 1.0f - u - v;
+		rec.u = w * unpack_uv(uv[0][0]) + u * unpack_uv(uv[1][0]) + v * unpack_uv(uv[2][0]);
+		rec.v = w * unpack_uv(uv[0][1]) + u * unpack_uv(uv[1][1]) + v * unpack_uv(uv[2][1]);
+		rec.uv_scale = uv_scale;
 		rec.t = t;
 		rec.p = r.point_at_parameter(t);
 		rec.mat_ptr = mat;
-		rec.normal = unit_vector((1.0f - u - v) * n0 + u * n1 + v * n2);
+		rec.normal = unit_vector(w * unpack_normal(n[0]) + u * unpack_normal(n[1]) + v * unpack_normal(n[2]));
+	}
+
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override {
+		float t, u, v;
+		if (!intersect(r, t_min, t_max, t, u, v))
+			return false;
+		shade(r, t, u, v, rec);
 		return true;
 	}
 
@@ -89,7 +126,8 @@ public:
 
 	virtual float pdf_value(const vec3& o, const vec3& v) const override {
 		hit_record rec;
-		if (this->hit(ray(o, v), 0.01f, FLT_MAX, rec)) {
+		STAT_INC(stat_shadow_rays);
+		if (this->hit(ray(o, v, 0, already_unit), 0.01f, FLT_MAX, rec)) {
 			float area = 0.5f * cross(v1 - v0, v2 - v0).length();
 			float distance_squared = rec.t * rec.t;
 			float cosine = fabs(dot(v, rec.normal));
@@ -0,0 +1,289 @@
+#pragma once
+#include <string.h>
+#include "vec3.h"
+#if defined(__AVX__)
+#include <immintrin.h>
+#define VEC3_AVX
+#endif
+
+// lane parallel math for code that works on 4 or 8 rays or primitives at once,
+// like the child boxes of a qbvh node. floatx4 and floatx8 hold one float per lane, comparisons return masks with
+// every bit of a lane set, and vec3x4/vec3x8 store x, y and z in separate
+// registers (structure of arrays). without SSE or AVX the same interface is
+// implemented with plain arrays and loops that the compiler can vectorize.
+class floatx4 {
+public:
+	static const int width = 4;
+	floatx4() {}
+	floatx4(float a);
+	static floatx4 load(const float* p);
+	void store(float* p) const;
+	float operator[](int i) const { float t[4]; store(t); return t[i]; }
+	int mask() const;	// bit i set if the sign bit of lane i is set
+
+#ifdef VEC3_SSE
+	floatx4(__m128 a) : v(a) {}
+	__m128 v;
+#else
+	float v[4];
+#endif
+};
+
+// floatx4
+// ----
+
+#ifdef VEC3_SSE
+inline floatx4::floatx4(float a) : v(_mm_set1_ps(a)) {}
+inline floatx4 floatx4::load(const float* p) { return _mm_loadu_ps(p); }
+inline void floatx4::store(float* p) const { _mm_storeu_ps(p, v); }
+inline int floatx4::mask() const { return _mm_movemask_ps(v); }
+
+inline floatx4 operator+(const floatx4& a, const floatx4& b) { return _mm_add_ps(a.v, b.v); }
+inline floatx4 operator-(const floatx4& a, const floatx4& b) { return _mm_sub_ps(a.v, b.v); }
+inline floatx4 operator*(const floatx4& a, const floatx4& b) { return _mm_mul_ps(a.v, b.v); }
+inline floatx4 operator/(const floatx4& a, const floatx4& b) { return _mm_div_ps(a.v, b.v); }
+inline floatx4 operator<(const floatx4& a, const floatx4& b) { return _mm_cmplt_ps(a.v, b.v); }
+inline floatx4 operator<=(const floatx4& a, const floatx4& b) { return _mm_cmple_ps(a.v, b.v); }
+inline floatx4 operator>(const floatx4& a, const floatx4& b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline floatx4 operator>=(const floatx4& a, const floatx4& b) { return _mm_cmpge_ps(a.v, b.v); }
+inline floatx4 operator&(const floatx4& a, const floatx4& b) { return _mm_and_ps(a.v, b.v); }
+inline floatx4 operator|(const floatx4& a, const floatx4& b) { return _mm_or_ps(a.v, b.v); }
+inline floatx4 min(const floatx4& a, const floatx4& b) { return _mm_min_ps(a.v, b.v); }
+inline floatx4 max(const floatx4& a, const floatx4& b) { return _mm_max_ps(a.v, b.v); }
+inline floatx4 sqrt(const floatx4& a) { return _mm_sqrt_ps(a.v); }
+inline floatx4 select(const floatx4& mask, const floatx4& a, const floatx4& b) {
+	return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+}
+inline floatx4 fast_rsqrt(const floatx4& x) {
+	__m128 y = _mm_rsqrt_ps(x.v);
+	__m128 xyy = _mm_mul_ps(_mm_mul_ps(x.v, y), y);
+	return _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), y), _mm_sub_ps(_mm_set1_ps(3.0f), xyy));
+}
+#else
+inline floatx4::floatx4(float a) { for (int i = 0; i < 4; i++) v[i] = a; }
+inline floatx4 floatx4::load(const float* p) { floatx4 r; memcpy(r.v, p, sizeof(r.v)); return r; }
+inline void floatx4::store(float* p) const { memcpy(p, v, sizeof(v)); }
+inline int floatx4::mask() const {
+	int m = 0;
+	for (int i = 0; i < 4; i++) m |= signbit(v[i]) ? 1 << i : 0;
+	return m;
+}
+
+inline float floatx4_bits(bool b) { unsigned int u = b ? 0xffffffffu : 0; float f; memcpy(&f, &u, 4); return f; }
+inline unsigned int floatx4_uint(float f) { unsigned int u; memcpy(&u, &f, 4); return u; }
+inline float floatx4_float(unsigned int u) { float f; memcpy(&f, &u, 4); return f; }
+
+#define FLOATX4_LANEWISE(name, expr) \
+	inline floatx4 name(const floatx4& a, const floatx4& b) { floatx4 r; for (int i = 0; i < 4; i++) r.v[i] = expr; return r; }
+FLOATX4_LANEWISE(operator+, a.v[i] + b.v[i])
+FLOATX4_LANEWISE(operator-, a.v[i] - b.v[i])
+FLOATX4_LANEWISE(operator*, a.v[i] * b.v[i])
+FLOATX4_LANEWISE(operator/, a.v[i] / b.v[i])
+FLOATX4_LANEWISE(operator<, floatx4_bits(a.v[i] < b.v[i]))
+FLOATX4_LANEWISE(operator<=, floatx4_bits(a.v[i] <= b.v[i]))
+FLOATX4_LANEWISE(operator>, floatx4_bits(a.v[i] > b.v[i]))
+FLOATX4_LANEWISE(operator>=, floatx4_bits(a.v[i] >= b.v[i]))
+FLOATX4_LANEWISE(operator&, floatx4_float(floatx4_uint(a.v[i]) & floatx4_uint(b.v[i])))
+FLOATX4_LANEWISE(operator|, floatx4_float(floatx4_uint(a.v[i]) | floatx4_uint(b.v[i])))
+FLOATX4_LANEWISE(min, a.v[i] < b.v[i] ? a.v[i] : b.v[i])
+FLOATX4_LANEWISE(max, a.v[i] > b.v[i] ? a.v[i] : b.v[i])
+#undef FLOATX4_LANEWISE
+inline floatx4 sqrt(const floatx4& a) { floatx4 r; for (int i = 0; i < 4; i++) r.v[i] = sqrtf(a.v[i]); return r; }
+inline floatx4 select(const floatx4& mask, const floatx4& a, const floatx4& b) {
+	floatx4 r;
+	for (int i = 0; i < 4; i++)
+		r.v[i] = floatx4_float((floatx4_uint(mask.v[i]) & floatx4_uint(a.v[i])) | (~floatx4_uint(mask.v[i]) & floatx4_uint(b.v[i])));
+	return r;
+}
+inline floatx4 fast_rsqrt(const floatx4& x) { floatx4 r; for (int i = 0; i < 4; i++) r.v[i] = fast_rsqrt(x.v[i]); return r; }
+#endif
+
+class floatx8 {
+public:
+	static const int width = 8;
+	floatx8() {}
+	floatx8(float a);
+	static floatx8 load(const float* p);
+	void store(float* p) const;
+	float operator[](int i) const { float t[8]; store(t); return t[i]; }
+	int mask() const;
+
+#ifdef VEC3_AVX
+	floatx8(__m256 a) : v(a) {}
+	__m256 v;
+#else
+	floatx8(const floatx4& l, const floatx4& h) : lo(l), hi(h) {}
+	floatx4 lo, hi;
+#endif
+};
+
+// floatx8
+// -------
+
+#ifdef VEC3_AVX
+inline floatx8::floatx8(float a) : v(_mm256_set1_ps(a)) {}
+inline floatx8 floatx8::load(const float* p) { return _mm256_loadu_ps(p); }
+inline void floatx8::store(float* p) const { _mm256_storeu_ps(p, v); }
+inline int floatx8::mask() const { return _mm256_movemask_ps(v); }
+
+inline floatx8 operator+(const floatx8& a, const floatx8& b) { return _mm256_add_ps(a.v, b.v); }
+inline floatx8 operator-(const floatx8& a, const floatx8& b) { return _mm256_sub_ps(a.v, b.v); }
+inline floatx8 operator*(const floatx8& a, const floatx8& b) { return _mm256_mul_ps(a.v, b.v); }
+inline floatx8 operator/(const floatx8& a, const floatx8& b) { return _mm256_div_ps(a.v, b.v); }
+inline floatx8 operator<(const floatx8& a, const floatx8& b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+inline floatx8 operator<=(const floatx8& a, const floatx8& b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+inline floatx8 operator>(const floatx8& a, const floatx8& b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+inline floatx8 operator>=(const floatx8& a, const floatx8& b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+inline floatx8 operator&(const floatx8& a, const floatx8& b) { return _mm256_and_ps(a.v, b.v); }
+inline floatx8 operator|(const floatx8& a, const floatx8& b) { return _mm256_or_ps(a.v, b.v); }
+inline floatx8 min(const floatx8& a, const floatx8& b) { return _mm256_min_ps(a.v, b.v); }
+inline floatx8 max(const floatx8& a, const floatx8& b) { return _mm256_max_ps(a.v, b.v); }
+inline floatx8 sqrt(const floatx8& a) { return _mm256_sqrt_ps(a.v); }
+inline floatx8 select(const floatx8& mask, const floatx8& a, const floatx8& b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+inline floatx8 fast_rsqrt(const floatx8& x) {
+	__m256 y = _mm256_rsqrt_ps(x.v);
+	__m256 xyy = _mm256_mul_ps(_mm256_mul_ps(x.v, y), y);
+	return _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), y), _mm256_sub_ps(_mm256_set1_ps(3.0f), xyy));
+}
+#else
+inline floatx8::floatx8(float a) : lo(a), hi(a) {}
+inline floatx8 floatx8::load(const float* p) { return floatx8(floatx4::load(p), floatx4::load(p + 4)); }
+inline void floatx8::store(float* p) const { lo.store(p); hi.store(p + 4); }
+inline int floatx8::mask() const { return lo.mask() | hi.mask() << 4; }
+
+#define FLOATX8_HALVES(name) \
+	inline floatx8 name(const floatx8& a, const floatx8& b) { return floatx8(name(a.lo, b.lo), name(a.hi, b.hi)); }
+FLOATX8_HALVES(operator+)
+FLOATX8_HALVES(operator-)
+FLOATX8_HALVES(operator*)
+FLOATX8_HALVES(operator/)
+FLOATX8_HALVES(operator<)
+FLOATX8_HALVES(operator<=)
+FLOATX8_HALVES(operator>)
+FLOATX8_HALVES(operator>=)
+FLOATX8_HALVES(operator&)
+FLOATX8_HALVES(operator|)
+FLOATX8_HALVES(min)
+FLOATX8_HALVES(max)
+#undef FLOATX8_HALVES
+inline floatx8 sqrt(const floatx8& a) { return floatx8(sqrt(a.lo), sqrt(a.hi)); }
+inline floatx8 select(const floatx8& mask, const floatx8& a, const floatx8& b) {
+	return floatx8(select(mask.lo, a.lo, b.lo), select(mask.hi, a.hi, b.hi));
+}
+inline floatx8 fast_rsqrt(const floatx8& x) { return floatx8(fast_rsqrt(x.lo), fast_rsqrt(x.hi)); }
+#endif
+
+// three lane registers, one per component. F is floatx4 or floatx8.
+template <class F>
+class vec3_lanes {
+public:
+	static const int width = F::width;
+	vec3_lanes() {}
+	vec3_lanes(const F& x, const F& y, const F& z) : x(x), y(y), z(z) {}
+	explicit vec3_lanes(const vec3& v) : x(v.x()), y(v.y()), z(v.z()) {}
+	static vec3_lanes load(const vec3* v);
+	static vec3_lanes load(const float* xs, const float* ys, const float* zs);
+	void store(vec3* v) const;
+	vec3 get(int lane) const { return vec3(x[lane], y[lane], z[lane]); }
+
+	F x, y, z;
+};
+
+// vec3_lanes
+// ----
+
+// gathers width vectors from an array of structures
+template <class F>
+vec3_lanes<F> vec3_lanes<F>::load(const vec3* v) {
+	float xs[F::width], ys[F::width], zs[F::width];
+	for (int i = 0; i < F::width; i++) {
+		xs[i] = v[i].x();
+		ys[i] = v[i].y();
+		zs[i] = v[i].z();
+	}
+	return load(xs, ys, zs);
+}
+
+template <class F>
+vec3_lanes<F> vec3_lanes<F>::load(const float* xs, const float* ys, const float* zs) {
+	return vec3_lanes(F::load(xs), F::load(ys), F::load(zs));
+}
+
+template <class F>
+void vec3_lanes<F>::store(vec3* v) const {
+	float xs[F::width], ys[F::width], zs[F::width];
+	x.store(xs);
+	y.store(ys);
+	z.store(zs);
+	for (int i = 0; i < F::width; i++)
+		v[i] = vec3(xs[i], ys[i], zs[i]);
+}
+
+template <class F>
+inline vec3_lanes<F> operator+(const vec3_lanes<F>& a, const vec3_lanes<F>& b) {
+	return vec3_lanes<F>(a.x + b.x, a.y + b.y, a.z + b.z);
+}
+
+template <class F>
+inline vec3_lanes<F> operator-(const vec3_lanes<F>& a, const vec3_lanes<F>& b) {
+	return vec3_lanes<F>(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+template <class F>
+inline vec3_lanes<F> operator*(const vec3_lanes<F>& a, const vec3_lanes<F>& b) {
+	return vec3_lanes<F>(a.x * b.x, a.y * b.y, a.z * b.z);
+}
+
+template <class F>
+inline vec3_lanes<F> operator*(const F& t, const vec3_lanes<F>& v) {
+	return vec3_lanes<F>(t * v.x, t * v.y, t * v.z);
+}
+
+template <class F>
+inline vec3_lanes<F> operator*(const vec3_lanes<F>& v, const F& t) {
+	return t * v;
+}
+
+template <class F>
+inline vec3_lanes<F> operator/(const vec3_lanes<F>& v, const F& t) {
+	F k = F(1.0f) / t;
+	return k * v;
+}
+
+template <class F>
+inline F dot(const vec3_lanes<F>& a, const vec3_lanes<F>& b) {
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+template <class F>
+inline vec3_lanes<F> cross(const vec3_lanes<F>& a, const vec3_lanes<F>& b) {
+	return vec3_lanes<F>(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+template <class F>
+inline F squared_length(const vec3_lanes<F>& v) {
+	return dot(v, v);
+}
+
+template <class F>
+inline F length(const vec3_lanes<F>& v) {
+	return sqrt(dot(v, v));
+}
+
+template <class F>
+inline vec3_lanes<F> unit_vector(const vec3_lanes<F>& v) {
+	return v / length(v);
+}
+
+template <class F>
+inline vec3_lanes<F> fast_unit_vector(const vec3_lanes<F>& v) {
+	return fast_rsqrt(dot(v, v)) * v;
+}
+
+template <class F>
+inline vec3_lanes<F> select(const F& mask, const vec3_lanes<F>& a, const vec3_lanes<F>& b) {
+	return vec3_lanes<F>(select(mask, a.x, b.x), select(mask, a.y, b.y), select(mask, a.z, b.z));
+}
+
+typedef vec3_lanes<floatx4> vec3x4;
+typedef vec3_lanes<floatx8> vec3x8;
\ No newline at end of file
@@ -1,6 +1,129 @@
 #pragma once
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include "vec3.h"
 
+// vertices as the loaders produce them, in full precision
 struct Vertex {
 	vec3 position;
 	vec3 normal;
-};
\ No newline at end of file
+	float u, v;	// texture coordinates, v pointing up the image
+};
+
+// compact attributes
+// ------------------
+// what a mesh keeps per triangle corner until a hit is shaded. with
+// RENDER_COMPACT_NORMALS (the default) a normal is folded onto the octahedron
+// |x| + |y| + |z| = 1, whose lower half is unfolded over the upper one, and
+// the square that results is stored as two 16 bit snorms: 4 bytes instead of
+// 12, at most octahedral_max_error degrees off. RENDER_HALF_UVS stores
+// texture coordinates as half floats, 11 significant bits: enough for uvs in
+// [0, 1] on textures up to about 2048 texels, not for tiled uvs far from 0,
+// so it is off by default. both are decoded only for the closest hit.
+#ifndef RENDER_COMPACT_NORMALS
+#define RENDER_COMPACT_NORMALS 1
+#endif
+#ifndef RENDER_HALF_UVS
+#define RENDER_HALF_UVS 0
+#endif
+
+// bounds the benchmark checks the encodings against
+const float octahedral_max_error = 0.005f;	// degrees
+const float half_uv_max_error = 1.0f / 4096;	// for uvs in [0, 1], half a step just below 1
+
+uint32_t encode_octahedral(const vec3& n);
+vec3 decode_octahedral(uint32_t packed);
+uint16_t float_to_half(float f);
+float half_to_float(uint16_t h);
+
+#if RENDER_COMPACT_NORMALS
+typedef uint32_t packed_normal;
+inline packed_normal pack_normal(const vec3& n) { return encode_octahedral(n); }
+inline vec3 unpack_normal(packed_normal n) { return decode_octahedral(n); }
+#else
+struct packed_normal {
+	float e[3];
+};
+inline packed_normal pack_normal(const vec3& n) { packed_normal p = { { n.x(), n.y(), n.z() } }; return p; }
+inline vec3 unpack_normal(const packed_normal& n) { return vec3(n.e[0], n.e[1], n.e[2]); }
+#endif
+
+#if RENDER_HALF_UVS
+typedef uint16_t packed_uv;
+inline packed_uv pack_uv(float u) { return float_to_half(u); }
+inline float unpack_uv(packed_uv u) { return half_to_float(u); }
+#else
+typedef float packed_uv;
+inline packed_uv pack_uv(float u) { return u; }
+inline float unpack_uv(packed_uv u) { return u; }
+#endif
+
+// octahedral normals
+// ------------------
+inline float octahedral_sign(float x) {
+	return x < 0 ? -1.0f : 1.0f;
+}
+
+// zero or invalid normals become +z
+uint32_t encode_octahedral(const vec3& n) {
+	float s = fabs(n.x()) + fabs(n.y()) + fabs(n.z());
+	if (!(s > 0))
+		return 0;
+	float x = n.x() / s, y = n.y() / s;
+	if (n.z() < 0) {
+		float folded = (1 - fabs(y)) * octahedral_sign(x);
+		y = (1 - fabs(x)) * octahedral_sign(y);
+		x = folded;
+	}
+	uint32_t qx = uint16_t(int16_t(lrintf(x * 32767)));
+	uint32_t qy = uint16_t(int16_t(lrintf(y * 32767)));
+	return qx | (qy << 16);
+}
+
+vec3 decode_octahedral(uint32_t packed) {
+	float x = fmaxf(int16_t(packed & 0xffff) / 32767.0f, -1.0f);
+	float y = fmaxf(int16_t(packed >> 16) / 32767.0f, -1.0f);
+	float z = 1 - fabs(x) - fabs(y);
+	if (z < 0) {
+		float unfolded = (1 - fabs(y)) * octahedral_sign(x);
+		y = (1 - fabs(x)) * octahedral_sign(y);
+		x = unfolded;
+	}
+	return unit_vector(vec3(x, y, z));
+}
+
+// half floats
+// -----------
+// round to nearest even, like the f16c instructions
+uint16_t float_to_half(float f) {
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	uint32_t sign = (bits >> 16) & 0x8000;
+	uint32_t magnitude = bits & 0x7fffffff;
+	if (magnitude > 0x7f800000)
+		return uint16_t(sign | 0x7e00);	// nan
+	if (magnitude >= 0x47800000)
+		return uint16_t(sign | 0x7c00);	// 65536 and up are infinite
+	if (magnitude < 0x38800000)	// below 2^-14 the half is denormal, in steps of 2^-24
+		return uint16_t(sign | uint32_t(lrintf(fabs(f) * 16777216.0f)));
+	uint32_t h = (magnitude - 0x38000000) >> 13;
+	uint32_t rest = magnitude & 0x1fff;
+	if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+		h++;	// a carry into the exponent is still the right rounding
+	return uint16_t(sign | h);
+}
+
+float half_to_float(uint16_t h) {
+	uint32_t sign = uint32_t(h & 0x8000) << 16;
+	uint32_t exponent = (h >> 10) & 0x1f;
+	uint32_t mantissa = h & 0x3ff;
+	if (exponent == 0) {
+		float f = mantissa / 16777216.0f;
+		return sign ? -f : f;
+	}
+	uint32_t bits = sign | (exponent == 31 ? 0x7f800000 : (exponent + 112) << 23) | (mantissa << 13);
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
\ No newline at end of file